@@ -3,7 +3,9 @@
 
 // Sizes of static memory allocation config
 #define MEM_CACHE_EQUITY_NODE_COUNT (64)
-#define MEM_CACHE_EVENT_NODE_COUNT (6)
+// Every equity keeps a periodic fetch node pending, plus a few for displays and
+// retries. The event node cache maps more slabs if a watch list outgrows this.
+#define MEM_CACHE_EVENT_NODE_COUNT (MEM_CACHE_EQUITY_NODE_COUNT + 16)
 
 // Equity/Portfolio config
 #define EQUITY_KEY_BYTES_MAX (7)
@@ -16,13 +18,157 @@ static const char *PORTFOLIO_IMPORT_TICKER_IGNORE[] = {
 	"Pending Activity",
 };
 
+// Quote provider config. A comma separated list of tickers is appended to the URL
+// prefix.
+#define QUOTE_PROVIDER_URL_PREFIX \
+	"https://query1.finance.yahoo.com/v7/finance/quote?symbols="
+// Where hedged fetches go (see EVENT_FETCH_HEDGE_PERCENTILE). Yahoo serves the same
+// API from a second host. Can't be longer than QUOTE_PROVIDER_URL_PREFIX.
+#define QUOTE_PROVIDER_HEDGE_URL_PREFIX \
+	"https://query2.finance.yahoo.com/v7/finance/quote?symbols="
+// CA bundle the provider's certificate is checked against instead of CURL's
+// default. Handy for a provider behind a proxy with its own CA, or a local stand-in
+// server with a self-signed certificate (see tests/h2_server.sh).
+// #define QUOTE_PROVIDER_CA_FILE "/etc/ssl/certs/provider.pem"
+// Where quotes are streamed from with EVENT_QUOTE_STREAM. Every ticker in the
+// portfolio is appended like with QUOTE_PROVIDER_URL_PREFIX.
+#define QUOTE_STREAM_URL_PREFIX "http://127.0.0.1:8080/quotes/stream?symbols="
+// Most tickers the provider takes in one request. Can't be more than 64.
+#define QUOTE_BATCH_SYMBOLS_MAX (50)
+// Room for every ticker in a batch and a comma after each.
+#define QUOTE_BATCH_SYMBOLS_BYTES_MAX \
+	(QUOTE_BATCH_SYMBOLS_MAX * (EQUITY_KEY_BYTES_MAX + 1))
+#define QUOTE_PROVIDER_URL_BYTES_MAX \
+	(sizeof(QUOTE_PROVIDER_URL_PREFIX) + QUOTE_BATCH_SYMBOLS_BYTES_MAX)
+// Headers sent with every quote request.
+#define QUOTE_PROVIDER_HEADERS { "Accept: application/json" }
+// Longest ETag or Last-Modified value kept for conditional requests. Responses with
+// longer ones aren't revalidated.
+#define QUOTE_VALIDATOR_BYTES_MAX (95)
+
 // Event config
+// How often each ticker's quote is fetched.
+#define EVENT_FETCH_STOCK_INTERVAL_MS (5000)
+// Periodic events are requeued up to half this much early or late each period so
+// events with the same interval don't line up on the same millisecond.
+#define EVENT_PERIODIC_JITTER_MS (64)
+// How long to wait before retrying a fetch that couldn't be started.
+#define EVENT_FETCH_STOCK_RETRY_MS (250)
+// The number of fetches in flight adapts to how the provider is doing. The limit
+// goes up by one for every limit's worth of fetches that finish within the latency
+// target while fetches are waiting on it. It halves when a fetch fails or the
+// provider throttles us (HTTP 429 or 503). Fetches over the limit wait in a FIFO
+// for one in flight to finish. The limit starts at EVENT_IO_CURL_BUFFER_LEN and
+// never goes above EVENT_IO_CURL_SLOTS_MAX.
+#define EVENT_FETCH_INFLIGHT_MIN (1)
+#define EVENT_FETCH_LATENCY_TARGET_MS (1500)
+// A fetch still running at this percentile of recent fetch latency gets a duplicate
+// sent to QUOTE_PROVIDER_HEDGE_URL_PREFIX from another slot. Whichever finishes
+// first wins and the other is cancelled. The percentile is taken over the last
+// EVENT_FETCH_LATENCY_SAMPLES successful fetches and there's no hedging until there
+// are that many. Hedges can't fire sooner than EVENT_FETCH_HEDGE_MIN_MS.
+#define EVENT_FETCH_HEDGE_PERCENTILE (95)
+#define EVENT_FETCH_HEDGE_MIN_MS (100)
+#define EVENT_FETCH_LATENCY_SAMPLES (64)
+// Hedges are at most this percent of fetches. Unused budget is saved up to
+// EVENT_FETCH_HEDGE_BURST hedges. A budget of 0 turns hedging off.
+#define EVENT_FETCH_HEDGE_BUDGET_PERCENT (5)
+#define EVENT_FETCH_HEDGE_BURST (2)
+// Instead of polling, keep one connection open to QUOTE_STREAM_URL_PREFIX and
+// apply quotes as they're pushed. The server has to send Server-Sent Events whose
+// data is quote JSON like the polling API's. Yahoo doesn't serve quotes that way so
+// this is meant for a relay in front of a provider that does.
+#define EVENT_QUOTE_STREAM (0)
+// How long to wait before reconnecting a stream that ended.
+#define EVENT_QUOTE_STREAM_RETRY_MS (5000)
+// A stream that sends nothing for this long, not even a heartbeat comment, is
+// dropped and reconnected.
+#define EVENT_QUOTE_STREAM_IDLE_S (60)
+// Connections opened to the provider while the portfolio is imported so the first
+// fetches don't pay for DNS, TCP and TLS. Keep it around the number of batches the
+// first round of fetches needs. With EVENT_IO_CURL_HTTP2_MULTIPLEX they all end up
+// on one connection anyway. The stream only ever warms one.
+#define EVENT_PREWARM_CONNECTIONS (2)
+// Fetching waits for the connections to warm up, but no longer than this.
+#define EVENT_PREWARM_TIMEOUT_MS (2000)
+// The portfolio redraw is delayed by this much after a quote update so updates
+// from a burst of fetches coalesce into one redraw.
+#define EVENT_DISPLAY_PORTFOLIO_DELAY_MS (100)
+// Higher priority class events due within this much of a lower class event run
+// before it. See enum event_priority.
+#define EVENT_PRIORITY_SLACK_MS (25)
+// Render events running later than this mean the loop is overloaded. They are
+// dropped so the time goes to keeping quotes fresh. Keep this well above twice
+// EVENT_PRIORITY_SLACK_MS since renders can be held back that long on purpose.
+#define EVENT_RENDER_DROP_LATE_MS (250)
+// Max events the dispatcher pulls from the queue at once.
+#define EVENT_LOOP_DUE_BATCH_LEN (64)
+// Events other threads can post to the loop before it drains them. Must be a
+// power of two.
+#define EVENT_RING_CAPACITY (256)
+// Backend used by the event queue. The heap is a good general purpose choice.
+// The timing wheel makes add and cancel O(1) which helps when thousands of
+// recurring events are pending at once.
+#define EVENT_QUEUE_BACKEND_HEAP (0)
+#define EVENT_QUEUE_BACKEND_WHEEL (1)
+// make test builds the event queue tests with each backend by defining this on the
+// command line.
+#ifndef EVENT_QUEUE_BACKEND
+#define EVENT_QUEUE_BACKEND EVENT_QUEUE_BACKEND_HEAP
+#endif
+// Slots in the event queue's (tag, target) index used to coalesce duplicate
+// events. Must be a power of two. Keep it at least twice the number of events
+// you expect to be pending so probes stay short.
+#define EVENT_QUEUE_INDEX_SLOTS (8192)
+// Shape of the timing wheel. Level 0 slots are 1 ms wide and every level above
+// it covers 2^EVENT_WHEEL_SLOT_BITS times the span of the level below. The
+// default covers 2^24 ms (~4.6 hours) before events spill into an overflow list.
+#define EVENT_WHEEL_LEVELS (4)
+#define EVENT_WHEEL_SLOT_BITS (6)
+// Fetch over HTTP/2 and run concurrent transfers as streams on one connection to
+// the provider instead of opening a connection for each. CURL falls back to
+// HTTP/1.1 if the provider doesn't negotiate HTTP/2.
+#define EVENT_IO_CURL_HTTP2_MULTIPLEX (0)
+// Transfer slots are set up EVENT_IO_CURL_BUFFER_LEN at a time. The first batch is
+// static and more are allocated while every slot is busy, up to
+// EVENT_IO_CURL_SLOTS_MAX transfers in flight. Without multiplexing every transfer
+// has its own connection so keep that modest. With it they share a few, at most
+// EVENT_IO_CURL_CONNECTIONS_MAX even if the provider falls back to HTTP/1.1.
+#if EVENT_IO_CURL_HTTP2_MULTIPLEX
+#define EVENT_IO_CURL_BUFFER_LEN (32)
+#define EVENT_IO_CURL_SLOTS_MAX (512)
+#define EVENT_IO_CURL_CONNECTIONS_MAX (8)
+#else
 #define EVENT_IO_CURL_BUFFER_LEN (8)
+#define EVENT_IO_CURL_SLOTS_MAX (64)
+#endif
+// Bytes of response body each in flight transfer can hold. A response bigger than
+// this aborts its transfer. A full batch of Yahoo quotes is around 150 KiB.
+#define EVENT_IO_CURL_RESPONSE_BYTES (256 * 1024)
+// How the loop waits on sockets. io_uring gets every registration change and the
+// wait (with the earliest deadline as its timeout) into one io_uring_enter per loop
+// iteration. It needs Linux 5.13 or newer for multishot polls.
+#define EVENT_LOOP_BACKEND_EPOLL (0)
+#define EVENT_LOOP_BACKEND_IO_URING (1)
+#define EVENT_LOOP_BACKEND EVENT_LOOP_BACKEND_EPOLL
+// Submission queue entries for the io_uring backend. More SQEs than this queued in
+// one loop iteration get submitted early. The completion queue is twice as big.
+#define EVENT_LOOP_URING_ENTRIES (256)
 // This param for epoll has been ignored since Linux 2.6.8 but we'll
 // make a sensible default for portability
 #define EVENT_LOOP_EPOLL_SIZE (8)
+// Starting size of the epoll_wait events array. It doubles whenever there are more
+// fds registered than it can report at once.
 #define EVENT_LOOP_EPOLL_EVENTS_LEN (4)
-
-#define EVENT_LOOP_FDS_MAX (16)
+// With the epoll backend, register CURL's sockets edge triggered so a socket CURL
+// hasn't drained yet doesn't wake every epoll_wait. After CURL handles a readable
+// socket, the loop peeks it and keeps handing it to CURL while the kernel still has
+// bytes for it, up to EVENT_LOOP_EPOLL_EDGE_DRAIN_MAX times before rearming it
+// instead. io_uring's polls are always edge triggered and get the same treatment.
+#define EVENT_LOOP_EPOLL_EDGE_TRIGGERED (0)
+#define EVENT_LOOP_EPOLL_EDGE_DRAIN_MAX (16)
+// The loop keeps a byte for every fd below RLIMIT_NOFILE with what it's registered
+// with epoll for. This caps that table if the limit is unlimited or huge.
+#define EVENT_LOOP_FDS_MAX (1 << 20)
 
 #endif // _TECZKA_CONFIG_H
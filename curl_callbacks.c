@@ -1,8 +1,10 @@
+#include <ctype.h>
 #include <curl/multi.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <curl/curl.h>
 
@@ -12,19 +14,83 @@
 #include "event_loop.h"
 #include "util.h"
 
-static struct event_io_curl *
-_event_io_find(CURL *easy_handle, struct event_io_curl event_io_array[],
-	       size_t array_len);
+static struct event_io_curl *_event_io_find(CURL *easy_handle);
 
 static int _curl_poll_remove(curl_socket_t socket,
 			     struct event_io_curl *event_io);
+/* If line is the header name (case insensitive) copies its value, without the
+ * surrounding whitespace, to value. value is left empty if it's longer than
+ * QUOTE_VALIDATOR_BYTES_MAX. @returns 1 if the name matched.
+ */
+static int _header_value_copy(const char *line, size_t line_len,
+			      const char *name,
+			      char value[QUOTE_VALIDATOR_BYTES_MAX + 1]);
 
 // REMINDER: DO NOT CALL CURL FUNCTIONS FROM THESE!!!
 
 size_t teczka_curl_write_callback(char *data, size_t size, size_t nmemb,
-				  void *my_ptr)
+				  void *event_io_curl_ptr)
 {
-	return 0;
+	if (NULL == event_io_curl_ptr) {
+		printf("No user defined pointer passed to teczka_curl_write_callback. "
+		       "Make sure CURLOPT_WRITEDATA was set.\n");
+		return 0;
+	}
+	struct event_io_curl *event_io =
+		(struct event_io_curl *)event_io_curl_ptr;
+	struct data_buffer *buffer = &event_io->buffer;
+	const size_t data_bytes = size * nmemb;
+	if (data_bytes >
+	    buffer->buffer_size_bytes - buffer->buffer_used_bytes) {
+		event_io->buffer_overflow = 1;
+		return 0;
+	}
+	// Parse straight out of CURL's buffer while the rest of the body is still
+	// on the way.
+	(void)quote_scan_feed(&event_io->quote_scan, data, data_bytes);
+	memcpy(buffer->buffer + buffer->buffer_used_bytes, data, data_bytes);
+	buffer->buffer_used_bytes += data_bytes;
+	return data_bytes;
+}
+
+size_t teczka_curl_stream_write_callback(char *data, size_t size, size_t nmemb,
+					 void *event_io_curl_ptr)
+{
+	if (NULL == event_io_curl_ptr) {
+		printf("No user defined pointer passed to teczka_curl_stream_write_callback. "
+		       "Make sure CURLOPT_WRITEDATA was set.\n");
+		return 0;
+	}
+	struct event_io_curl *event_io =
+		(struct event_io_curl *)event_io_curl_ptr;
+	const size_t data_bytes = size * nmemb;
+	if (SSE_SCAN_ERROR_OK !=
+	    sse_scan_feed(&event_io->sse_scan, data, data_bytes)) {
+		return 0;
+	}
+	return data_bytes;
+}
+
+size_t teczka_curl_header_callback(char *data, size_t size, size_t nmemb,
+				   void *event_io_curl_ptr)
+{
+	if (NULL == event_io_curl_ptr) {
+		printf("No user defined pointer passed to teczka_curl_header_callback. "
+		       "Make sure CURLOPT_HEADERDATA was set.\n");
+		return 0;
+	}
+	struct event_io_curl *event_io =
+		(struct event_io_curl *)event_io_curl_ptr;
+	const size_t line_len = size * nmemb;
+	if (line_len >= 5 && 0 == memcmp(data, "HTTP/", 5)) {
+		event_io->response_etag[0] = '\0';
+		event_io->response_last_modified[0] = '\0';
+	} else if (!_header_value_copy(data, line_len, "etag",
+				       event_io->response_etag)) {
+		(void)_header_value_copy(data, line_len, "last-modified",
+					 event_io->response_last_modified);
+	}
+	return line_len;
 }
 
 int teczka_curl_timer_callback(CURLM *multi_handle, long timeout_ms,
@@ -43,7 +109,10 @@ int teczka_curl_timer_callback(CURLM *multi_handle, long timeout_ms,
 	switch (curl_timeout_event->tag) {
 	case TECZKA_EVENT_CURL_TIMEOUT:
 		break;
+	case TECZKA_EVENT_PORTFOLIO_IMPORTED:
 	case TECZKA_EVENT_FETCH_STOCK:
+	case TECZKA_EVENT_FETCH_HEDGE:
+	case TECZKA_EVENT_STREAM_CONNECT:
 	case TECZKA_EVENT_DISPLAY_STOCK:
 	case TECZKA_EVENT_DISPLAY_PORTFOLIO:
 	default:
@@ -63,8 +132,9 @@ int teczka_curl_timer_callback(CURLM *multi_handle, long timeout_ms,
 int teczka_curl_socket_callback(CURL *easy_handle, curl_socket_t socket,
 				int what,
 				void *teczka_curl_socket_callback_context_ptr,
-				void *event_io_curl_ptr)
+				void *socket_ptr)
 {
+	(void)socket_ptr;
 	// Important note: the easy_handle is not always one of ours. CURL could pass an
 	// internal easy handle. In this case, there is no associated event_io_curl struct.
 	if (NULL == easy_handle) {
@@ -76,38 +146,17 @@ int teczka_curl_socket_callback(CURL *easy_handle, curl_socket_t socket,
 		       "Make sure CURLMOPT_SOCKETDATA was set.\n");
 		return -1;
 	}
-	// context is not null.
-	struct teczka_curl_socket_callback_context *context =
-		(struct teczka_curl_socket_callback_context *)
-			teczka_curl_socket_callback_context_ptr;
-	// event_io_passed is null if we haven't bound it to the socket yet.
-	struct event_io_curl *event_io_passed =
-		(struct event_io_curl *)event_io_curl_ptr;
-	struct event_io_curl *event_io_found = NULL;
-	// If event_io is null, let's try to find it to bind it to the socket.
-	// event_io_found can be null if the easy_handle is internal to CURL. That
-	// case is ok because we don't need to track socket in our data structures
-	if (NULL == event_io_passed) {
-		event_io_found = _event_io_find(easy_handle,
-						context->event_io_array,
-						EVENT_IO_CURL_BUFFER_LEN);
-	}
-
+	// Nothing is bound to the socket. With HTTP/2 multiplexing one socket carries
+	// several transfers and outlives any of them, so whatever we bound could be
+	// stale by the time CURL hands it back. The transfer CURL is calling about is
+	// looked up from easy_handle instead. It's NULL for CURL's internal handles
+	// which is ok because we don't need to track their sockets.
+	struct event_io_curl *event_io = _event_io_find(easy_handle);
 	if (CURL_POLL_REMOVE == what) {
-		// Prefer passed one. Fallback to found one.
-		struct event_io_curl *event_io_to_remove = event_io_passed;
-		if (NULL == event_io_passed) {
-			event_io_to_remove = event_io_found;
-		} else {
-			// If we had an event bound to socket, unbind it
-			(void)curl_multi_assign(context->multi_handle, socket,
-						NULL);
-		}
-		(void)_curl_poll_remove(socket, event_io_to_remove);
+		(void)_curl_poll_remove(socket, event_io);
 		return 0;
 	}
 	uint32_t event_loop_action_flags = 0;
-	struct event_io_curl *event_io_bound_socket = event_io_passed;
 	// Now we know our op should be to add or modify the actions to listen for on socket.
 	if (CURL_POLL_IN & what) {
 		event_loop_action_flags |= EVENT_LOOP_FD_POLL_IN;
@@ -115,40 +164,62 @@ int teczka_curl_socket_callback(CURL *easy_handle, curl_socket_t socket,
 	if (CURL_POLL_OUT & what) {
 		event_loop_action_flags |= EVENT_LOOP_FD_POLL_OUT;
 	}
-
-	if (NULL != event_io_passed) {
-		event_io_passed->sockfd = socket;
-	} else {
-		// If this is the case we need to bind event to socket
-		if (NULL != event_io_found) {
-			event_io_bound_socket = event_io_found;
-			event_io_found->sockfd = socket;
-			(void)curl_multi_assign(context->multi_handle, socket,
-						event_io_found);
-		}
+	if (NULL != event_io) {
+		event_io->sockfd = socket;
 	}
-	(void)event_loop_fd_addmod(socket, event_loop_action_flags,
-				   event_io_bound_socket);
+	(void)event_loop_fd_addmod(socket, event_loop_action_flags);
 
 	return 0;
 }
 
-static struct event_io_curl *
-_event_io_find(CURL *easy_handle, struct event_io_curl event_io_array[],
-	       size_t array_len)
+static struct event_io_curl *_event_io_find(CURL *easy_handle)
 {
-	for (size_t i = 0; i < array_len; ++i) {
-		if (easy_handle == event_io_array[i].easy_handle) {
-			return &event_io_array[i];
+	// CURL's internal handles never had CURLOPT_PRIVATE set so they give NULL.
+	char *event_io_ptr = NULL;
+	(void)curl_easy_getinfo(easy_handle, CURLINFO_PRIVATE, &event_io_ptr);
+	struct event_io_curl *event_io = (struct event_io_curl *)event_io_ptr;
+	// A pooled handle only has a socket while it's in flight but make sure.
+	if (NULL == event_io || easy_handle != event_io->easy_handle) {
+		return NULL;
+	}
+	return event_io;
+}
+
+static int _header_value_copy(const char *line, size_t line_len,
+			      const char *name,
+			      char value[QUOTE_VALIDATOR_BYTES_MAX + 1])
+{
+	const size_t name_len = strlen(name);
+	if (line_len <= name_len || ':' != line[name_len]) {
+		return 0;
+	}
+	for (size_t i = 0; i < name_len; ++i) {
+		if (tolower((unsigned char)line[i]) != name[i]) {
+			return 0;
 		}
 	}
-	return NULL;
+	size_t start = name_len + 1;
+	size_t end = line_len;
+	while (start < end && (' ' == line[start] || '\t' == line[start])) {
+		++start;
+	}
+	while (end > start && isspace((unsigned char)line[end - 1])) {
+		--end;
+	}
+	const size_t value_len = end - start;
+	if (value_len > QUOTE_VALIDATOR_BYTES_MAX) {
+		value[0] = '\0';
+		return 1;
+	}
+	memcpy(value, line + start, value_len);
+	value[value_len] = '\0';
+	return 1;
 }
 
 static int _curl_poll_remove(curl_socket_t socket,
 			     struct event_io_curl *event_io)
 {
-	if (NULL != event_io) {
+	if (NULL != event_io && socket == event_io->sockfd) {
 		event_io->sockfd = -1;
 	}
 	enum event_loop_fd_del_error del_result = event_loop_fd_del(socket);
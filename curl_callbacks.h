@@ -9,13 +9,12 @@
 
 struct teczka_curl_socket_callback_context {
 	CURLM *multi_handle;
-	struct event_io_curl *event_io_array;
 };
 
 // IMPORTANT NOTE: These callbacks SHOULD NOT call libcurl functions. CURL's docs state
 // it can lead to recursive behavior.
-// EXCEPTION: curl_multi_assign can be called from mulit callbacks. This is useful when the socket
-// callback is removing a socket. We'd like to unassociate our pointer with that socket.
+// EXCEPTION: curl_easy_getinfo with CURLINFO_PRIVATE just reads back the pointer we set
+// with CURLOPT_PRIVATE. That's how the socket callback finds a transfer's event_io_curl.
 
 // https://curl.se/libcurl/c/CURLOPT_WRITEFUNCTION.html
 /* Callback function that CURL calls when there is data we must copy to our own buffers.
@@ -27,10 +26,37 @@ struct teczka_curl_socket_callback_context {
  * given in curl_easy_setopt with CURLOPT_WRITEDATA option.
  * @returns The number of bytes processed by our callback. If that number does not
  * equal size * nmemb, CURL sees that as an error.
+ * Data is scanned for quotes with the event_io_curl's quote_scan and appended to its
+ * buffer so the body is still around if something goes wrong. If it doesn't fit, the
+ * buffer_overflow flag is set and 0 is returned so CURL aborts the transfer with
+ * CURLE_WRITE_ERROR. A partial quote response is no use to us so we don't keep it:
+ * the scanned quotes wait in the event_io_curl until the transfer is done.
  */
 size_t teczka_curl_write_callback(char *data, size_t size, size_t nmemb,
 				  void *event_io_curl_ptr);
 
+/* Write callback for the quote stream. Instead of keeping the body, each chunk goes
+ * straight through the event_io_curl's sse_scan.
+ * Params and return value are the same as teczka_curl_write_callback's.
+ */
+size_t teczka_curl_stream_write_callback(char *data, size_t size, size_t nmemb,
+					 void *event_io_curl_ptr);
+
+// https://curl.se/libcurl/c/CURLOPT_HEADERFUNCTION.html
+/* Callback function that CURL calls with each header line of the response.
+ * @param data: One complete header line including its CRLF. NOT null terminated.
+ * @param size: Always one.
+ * @param nmemb: Length of the line.
+ * @param event_io_curl_ptr: Pointer to the event_io_curl for the transfer. Given with
+ * CURLOPT_HEADERDATA.
+ * @returns size * nmemb. Anything else makes CURL abort the transfer.
+ * ETag and Last-Modified values are copied to the event_io_curl's response
+ * validators. A status line clears them since each response (like one after a
+ * redirect) brings its own.
+ */
+size_t teczka_curl_header_callback(char *data, size_t size, size_t nmemb,
+				   void *event_io_curl_ptr);
+
 // https://curl.se/libcurl/c/CURLMOPT_TIMERFUNCTION.html
 /* Callback function that CURL calls to inform the application curl_multi_socket_action
  * must be called in timeout_ms. CURL's documents dictate only one timer will be active
@@ -50,20 +76,22 @@ int teczka_curl_timer_callback(CURLM *multi_handle, long timeout_ms,
  * descriptors) should be polled for activity by the application (w/ epoll, select, poll,
  * etc.).
  * @param easy_handle: CURL easy handle. This indicates which transfer the socket is related to.
+ * Our easy handles have their event_io_curl set as CURLOPT_PRIVATE.
  * @param socket: The socket (fd) we need to listen on. If what is CURL_POLL_REMOVE, ignore this
  * parameter.
  * @param what: Status of the given socket. This tells the application what to do with socket.
- * @param teczka_curl_socket_callback_context_ptr: Pointer to a structure containing the epoll
- * file descriptor and all the current inflight curl events. This will help us update epoll's
- * state and search for the corresponding easy handle if we haven't bound the curl event to
- * the socket yet.
- * This pointer is given in curl_multi_setopt with CURLMOPT_SOCKETDATA option.
- * @param event_io_curl_ptr: Pointer to the event_io_curl struct associated with the socket socket.
- * We can bind a pointer to a socket with curl_mutli_assign.
+ * @param teczka_curl_socket_callback_context_ptr: Pointer to the loop's
+ * teczka_curl_socket_callback_context, given in curl_multi_setopt with CURLMOPT_SOCKETDATA
+ * option. It only holds the multi handle and nothing in it is read here. NULL means
+ * CURLMOPT_SOCKETDATA wasn't set and is an error. Sockets go to the event loop's poll
+ * backend through event_loop_fd_addmod and event_loop_fd_del instead.
+ * @param socket_ptr: Pointer bound to the socket with curl_multi_assign. We never bind one
+ * so this is always NULL. A multiplexed socket is shared by several transfers so the
+ * transfer is found through easy_handle's CURLOPT_PRIVATE instead.
  */
 int teczka_curl_socket_callback(CURL *easy_handle, curl_socket_t socket,
 				int what,
 				void *teczka_curl_socket_callback_context_ptr,
-				void *event_io_curl_ptr);
+				void *socket_ptr);
 
 #endif // _TECZKA_CURL_CALLBACKS_H
@@ -39,6 +39,9 @@ struct equity {
 	char key[EQUITY_KEY_BYTES_MAX + 1];
 	struct equity_valuation valuation;
 	struct equity_ownership ownership;
+	// Index of the fetch_partition (see event.h) the event loop fetches this
+	// equity's quote with. Set when the loop is seeded.
+	size_t fetch_partition;
 	char name[EQUITY_NAME_BYTES_MAX + 1];
 };
 
@@ -170,7 +173,7 @@ equity_ownership_deltas_update(struct equity_ownership *ownership,
 	ownership->delta_daily_absolute_cents =
 		equity_total_value_cents(daily_delta_absolute_per_share,
 					 ownership->share_count_hundredths);
-	ownership->delta_daily_absolute_cents =
+	ownership->delta_daily_basis_points =
 		delta_basis_points(ownership->delta_daily_absolute_cents,
 				   ownership->cost_basis_cents);
 	return 0;
@@ -1,16 +1,55 @@
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 
+#include "config.h"
 #include "event.h"
 #include "kette.h"
 
+// Each backend implements these. The public functions below handle argument checks
+// and forward to them.
+static int _queue_init(struct event_queue *queue);
+static int _queue_insert(struct event_queue *queue, struct event_node *node);
+static void _queue_remove(struct event_queue *queue, struct event_node *node);
+static struct event_node *_queue_first(struct event_queue *queue);
+static void _queue_advance(struct event_queue *queue, uint64_t now_ms);
+
+// (tag, target) index helpers. The index uses linear probing and never holds more
+// than 3/4 of its slots so probes stay short. Nodes that don't fit are still
+// queued, they just can't be coalesced.
+#define INDEX_MASK ((size_t)EVENT_QUEUE_INDEX_SLOTS - 1)
+#define INDEX_LEN_MAX ((size_t)EVENT_QUEUE_INDEX_SLOTS / 4 * 3)
+static inline size_t _index_hash(enum event_tag tag, const void *target);
+// Returns the slot holding the node for (tag, target) or the empty slot where it
+// would go.
+static size_t _index_find(const struct event_queue *queue, enum event_tag tag,
+			  const void *target);
+static void _index_add(struct event_queue *queue, struct event_node *node);
+static void _index_del(struct event_queue *queue, struct event_node *node);
+
+// Returns the time the queue orders a node by. Lower priority classes are pushed
+// back by EVENT_PRIORITY_SLACK_MS per class.
+static inline uint64_t _event_node_key(const struct event_node *node);
+
 int event_queue_init(struct event_queue *queue)
 {
 	if (NULL == queue) {
 		return 1;
 	}
-	slist_init(&queue->event_head);
-	queue->curl_timeout_event = (struct event){ 0 };
+	if (_queue_init(queue)) {
+		return 1;
+	}
+	for (size_t i = 0; i < EVENT_QUEUE_INDEX_SLOTS; ++i) {
+		queue->index[i] = NULL;
+	}
+	queue->index_len = 0;
+	// CURL has no timeout until its timer callback gives us one. UINT64_MAX is how
+	// the callback stores -1.
+	queue->curl_timeout_event = (struct event){
+		.tag = TECZKA_EVENT_CURL_TIMEOUT,
+		.run_timestamp_ms = UINT64_MAX,
+	};
 	return 0;
 }
 
@@ -19,47 +58,561 @@ int event_queue_add(struct event_queue *queue, struct event_node *event)
 	if (NULL == queue || NULL == event) {
 		return 1;
 	}
-	struct event_node *prev = NULL;
-	struct event_node *curr =
-		list_entry(queue->event_head.next, struct event_node, link);
-	// queue->event_head is a "pseudo" head (I don't know proper term for this).
-	// It doesn't actually hold a value, it's just a link.
-	while (&curr->link != &queue->event_head) {
-		// If the event to add should run sooner then we stop.
-		if (event->event.run_timestamp_ms <
-		    curr->event.run_timestamp_ms) {
+	const int insert_result = _queue_insert(queue, event);
+	if (0 == insert_result) {
+		_index_add(queue, event);
+	}
+	return insert_result;
+}
+
+const struct event_node *event_queue_dequeue(struct event_queue *queue)
+{
+	if (NULL == queue) {
+		return NULL;
+	}
+	struct event_node *head = _queue_first(queue);
+	if (NULL != head) {
+		_queue_remove(queue, head);
+		_index_del(queue, head);
+	}
+	return head;
+}
+
+const struct event_node *event_queue_peek(struct event_queue *queue)
+{
+	if (NULL == queue) {
+		return NULL;
+	}
+	return _queue_first(queue);
+}
+
+int event_queue_remove(struct event_queue *queue, struct event_node *event)
+{
+	if (NULL == queue || NULL == event) {
+		return 1;
+	}
+	_queue_remove(queue, event);
+	_index_del(queue, event);
+	return 0;
+}
+
+void event_queue_advance(struct event_queue *queue, uint64_t now_ms)
+{
+	if (NULL == queue) {
+		return;
+	}
+	_queue_advance(queue, now_ms);
+}
+
+size_t event_queue_dequeue_due(struct event_queue *queue, uint64_t now_ms,
+			       struct event_node *out[], size_t max)
+{
+	if (NULL == queue || NULL == out) {
+		return 0;
+	}
+	_queue_advance(queue, now_ms);
+	size_t out_len = 0;
+	while (out_len < max) {
+		struct event_node *head = _queue_first(queue);
+		if (NULL == head || head->event.run_timestamp_ms > now_ms) {
 			break;
 		}
-		prev = curr;
-		curr = list_entry(curr->link.next, struct event_node, link);
+		_queue_remove(queue, head);
+		_index_del(queue, head);
+		out[out_len++] = head;
 	}
+	return out_len;
+}
 
-	// If prev is NULL then there are no events in the queue. We add it directly
-	// after the pseudo head. Otherwise we add it after prev.
-	if (NULL == prev) {
-		slist_add(&event->link, &queue->event_head);
-	} else {
-		slist_add(&event->link, &prev->link);
+struct event_node *event_queue_pending_get(struct event_queue *queue,
+					   enum event_tag tag,
+					   const void *target)
+{
+	if (NULL == queue) {
+		return NULL;
 	}
+	return queue->index[_index_find(queue, tag, target)];
+}
 
+int event_queue_reschedule(struct event_queue *queue, struct event_node *event,
+			   uint64_t run_timestamp_ms)
+{
+	if (NULL == queue || NULL == event) {
+		return 1;
+	}
+	// The node was already in the queue so there is room to insert it again.
+	_queue_remove(queue, event);
+	event->event.run_timestamp_ms = run_timestamp_ms;
+	(void)_queue_insert(queue, event);
 	return 0;
 }
 
-const struct event_node *event_queue_dequeue(struct event_queue *queue)
+static inline uint64_t _event_node_key(const struct event_node *node)
+{
+	return node->event.run_timestamp_ms +
+	       (uint64_t)event_priority_get(&node->event) *
+		       EVENT_PRIORITY_SLACK_MS;
+}
+
+static inline size_t _index_hash(enum event_tag tag, const void *target)
+{
+	// Targets are at least 8 byte aligned so the low bits carry nothing. Multiply
+	// by the 64 bit golden ratio to mix and keep the high bits.
+	uint64_t key = ((uint64_t)(uintptr_t)target >> 3) ^
+		       ((uint64_t)tag << 56);
+	key *= UINT64_C(0x9E3779B97F4A7C15);
+	return (size_t)(key >> 32) & INDEX_MASK;
+}
+
+static size_t _index_find(const struct event_queue *queue, enum event_tag tag,
+			  const void *target)
+{
+	size_t i = _index_hash(tag, target);
+	while (NULL != queue->index[i]) {
+		const struct event *event = &queue->index[i]->event;
+		if (tag == event->tag && target == event_target_get(event)) {
+			break;
+		}
+		i = (i + 1) & INDEX_MASK;
+	}
+	return i;
+}
+
+static void _index_add(struct event_queue *queue, struct event_node *node)
+{
+	if (queue->index_len >= INDEX_LEN_MAX) {
+		return;
+	}
+	const size_t i = _index_find(queue, node->event.tag,
+				     event_target_get(&node->event));
+	// Another node already owns (tag, target). Leave it indexed.
+	if (NULL != queue->index[i]) {
+		return;
+	}
+	queue->index[i] = node;
+	++queue->index_len;
+}
+
+static void _index_del(struct event_queue *queue, struct event_node *node)
 {
-	if (NULL == queue || list_empty(&queue->event_head)) {
+	size_t i = _index_find(queue, node->event.tag,
+			       event_target_get(&node->event));
+	// The node might not be indexed if it was a duplicate or the index was full.
+	if (node != queue->index[i]) {
+		return;
+	}
+	queue->index[i] = NULL;
+	--queue->index_len;
+	// Backward shift deletion. Pull later nodes in the probe run into the hole
+	// if their home slot is at or before it so lookups never stop early.
+	size_t hole = i;
+	size_t j = (i + 1) & INDEX_MASK;
+	while (NULL != queue->index[j]) {
+		const struct event *event = &queue->index[j]->event;
+		const size_t home =
+			_index_hash(event->tag, event_target_get(event));
+		if (((j - home) & INDEX_MASK) >= ((j - hole) & INDEX_MASK)) {
+			queue->index[hole] = queue->index[j];
+			queue->index[j] = NULL;
+			hole = j;
+		}
+		j = (j + 1) & INDEX_MASK;
+	}
+}
+
+#undef INDEX_LEN_MAX
+#undef INDEX_MASK
+
+#if EVENT_QUEUE_BACKEND == EVENT_QUEUE_BACKEND_WHEEL
+
+#define WHEEL_SLOT_MASK ((uint64_t)EVENT_WHEEL_SLOTS - 1)
+// Number of low timestamp bits consumed by the levels below level.
+#define WHEEL_LEVEL_SHIFT(level) ((level) * EVENT_WHEEL_SLOT_BITS)
+#define WHEEL_SLOT_INDEX(ts, level) \
+	(((ts) >> WHEEL_LEVEL_SHIFT(level)) & WHEEL_SLOT_MASK)
+#define WHEEL_BUCKET(level, slot) ((level) * EVENT_WHEEL_SLOTS + (slot))
+
+// Returns a mask of the slots after slot.
+static inline uint64_t _slots_after(uint64_t slot);
+// Returns the index of the lowest set bit. bits must not be 0.
+static inline uint64_t _lowest_bit(uint64_t bits);
+// Returns the node in the bucket with the lowest key. Ties go to the
+// node that has been in the bucket the longest.
+static struct event_node *_bucket_min(struct dlink *bucket);
+// Moves every node in from to the end of to. from is left empty.
+static void _bucket_move_tail(struct dlink *from, struct dlink *to);
+// Removes every node from the bucket and inserts it again based on now_ms.
+static void _bucket_cascade(struct event_queue *queue, size_t bucket);
+static void _bucket_unlink(struct event_queue *queue, struct event_node *node);
+
+static int _queue_init(struct event_queue *queue)
+{
+	for (size_t i = 0; i < EVENT_WHEEL_BUCKET_COUNT; ++i) {
+		dlist_init(&queue->buckets[i]);
+	}
+	for (size_t i = 0; i < EVENT_WHEEL_LEVELS; ++i) {
+		queue->occupied[i] = 0;
+	}
+	// Start at the current time so the first events don't all land in overflow.
+	queue->now_ms = timestamp_ms_get();
+	queue->len = 0;
+	return 0;
+}
+
+static int _queue_insert(struct event_queue *queue, struct event_node *node)
+{
+	const uint64_t run_ms = _event_node_key(node);
+	size_t bucket = EVENT_WHEEL_BUCKET_OVERFLOW;
+	if (run_ms <= queue->now_ms) {
+		bucket = EVENT_WHEEL_BUCKET_EXPIRED;
+	} else {
+		// The highest bit that differs between now and the run time picks the
+		// level. Everything below that level's span is the same block as now.
+		const uint64_t differ = run_ms ^ queue->now_ms;
+		for (size_t level = 0; level < EVENT_WHEEL_LEVELS; ++level) {
+			if (differ >> WHEEL_LEVEL_SHIFT(level + 1)) {
+				continue;
+			}
+			const uint64_t slot = WHEEL_SLOT_INDEX(run_ms, level);
+			bucket = WHEEL_BUCKET(level, slot);
+			queue->occupied[level] |= (uint64_t)1 << slot;
+			break;
+		}
+	}
+	dlist_add_tail(&node->link, &queue->buckets[bucket]);
+	node->wheel_bucket = bucket;
+	++queue->len;
+	return 0;
+}
+
+static void _queue_remove(struct event_queue *queue, struct event_node *node)
+{
+	_bucket_unlink(queue, node);
+	--queue->len;
+}
+
+static struct event_node *_queue_first(struct event_queue *queue)
+{
+	if (0 == queue->len) {
 		return NULL;
 	}
-	const struct event_node *head =
-		list_entry(queue->event_head.next, struct event_node, link);
-	slist_del(queue->event_head.next);
-	return head;
+	struct dlink *expired = &queue->buckets[EVENT_WHEEL_BUCKET_EXPIRED];
+	if (!list_empty(expired)) {
+		// Everything here is due so FIFO order is good enough. The dispatcher
+		// runs a batch by class anyway.
+		return list_entry(expired->next, struct event_node, link);
+	}
+	// Level 0 slots are 1 ms wide so every node in one has the same key.
+	uint64_t bits = queue->occupied[0] &
+			_slots_after(WHEEL_SLOT_INDEX(queue->now_ms, 0));
+	if (bits) {
+		struct dlink *bucket =
+			&queue->buckets[WHEEL_BUCKET(0, _lowest_bit(bits))];
+		return list_entry(bucket->next, struct event_node, link);
+	}
+	// Higher level slots hold a range of keys. Lower levels always run
+	// before higher ones so the first occupied slot has the earliest node.
+	for (size_t level = 1; level < EVENT_WHEEL_LEVELS; ++level) {
+		bits = queue->occupied[level] &
+		       _slots_after(WHEEL_SLOT_INDEX(queue->now_ms, level));
+		if (bits) {
+			return _bucket_min(&queue->buckets[WHEEL_BUCKET(
+				level, _lowest_bit(bits))]);
+		}
+	}
+	return _bucket_min(&queue->buckets[EVENT_WHEEL_BUCKET_OVERFLOW]);
 }
 
-const struct event_node *event_queue_peek(struct event_queue *queue)
+static void _queue_advance(struct event_queue *queue, uint64_t now_ms)
+{
+	while (queue->now_ms < now_ms) {
+		// Due level 0 slots move to the expired bucket in order.
+		const uint64_t block_mask = ~WHEEL_SLOT_MASK;
+		uint64_t bits = queue->occupied[0] &
+				_slots_after(WHEEL_SLOT_INDEX(queue->now_ms, 0));
+		if (bits) {
+			const uint64_t slot = _lowest_bit(bits);
+			const uint64_t slot_ms =
+				(queue->now_ms & block_mask) | slot;
+			if (slot_ms > now_ms) {
+				break;
+			}
+			queue->now_ms = slot_ms;
+			_bucket_move_tail(
+				&queue->buckets[WHEEL_BUCKET(0, slot)],
+				&queue->buckets[EVENT_WHEEL_BUCKET_EXPIRED]);
+			queue->occupied[0] &= ~((uint64_t)1 << slot);
+			continue;
+		}
+		// Nothing left in this level 0 block. Jump straight to the next
+		// occupied slot of the lowest level that has one and cascade it.
+		int cascaded = 0;
+		for (size_t level = 1; level < EVENT_WHEEL_LEVELS; ++level) {
+			bits = queue->occupied[level] &
+			       _slots_after(WHEEL_SLOT_INDEX(queue->now_ms,
+							     level));
+			if (!bits) {
+				continue;
+			}
+			const uint64_t slot = _lowest_bit(bits);
+			const uint64_t parent_shift =
+				WHEEL_LEVEL_SHIFT(level + 1);
+			const uint64_t slot_ms =
+				((queue->now_ms >> parent_shift)
+				 << parent_shift) |
+				(slot << WHEEL_LEVEL_SHIFT(level));
+			if (slot_ms > now_ms) {
+				goto done;
+			}
+			queue->now_ms = slot_ms;
+			_bucket_cascade(queue, WHEEL_BUCKET(level, slot));
+			cascaded = 1;
+			break;
+		}
+		if (cascaded) {
+			continue;
+		}
+		// The wheel is empty. Only overflow can be left.
+		const struct event_node *overflow_min = _bucket_min(
+			&queue->buckets[EVENT_WHEEL_BUCKET_OVERFLOW]);
+		if (NULL == overflow_min) {
+			break;
+		}
+		const uint64_t top_shift = WHEEL_LEVEL_SHIFT(EVENT_WHEEL_LEVELS);
+		const uint64_t top_block_ms =
+			(_event_node_key(overflow_min) >> top_shift)
+			<< top_shift;
+		if (top_block_ms > now_ms) {
+			break;
+		}
+		queue->now_ms = top_block_ms;
+		_bucket_cascade(queue, EVENT_WHEEL_BUCKET_OVERFLOW);
+	}
+done:
+	if (queue->now_ms < now_ms) {
+		queue->now_ms = now_ms;
+	}
+}
+
+static inline uint64_t _slots_after(uint64_t slot)
+{
+	if (slot >= 63) {
+		return 0;
+	}
+	return ~(uint64_t)0 << (slot + 1);
+}
+
+static inline uint64_t _lowest_bit(uint64_t bits)
+{
+	return (uint64_t)__builtin_ctzll(bits);
+}
+
+static struct event_node *_bucket_min(struct dlink *bucket)
+{
+	struct event_node *min = NULL;
+	struct event_node *curr;
+	list_for_each(bucket, curr, struct event_node, link) {
+		if (NULL == min ||
+		    _event_node_key(curr) < _event_node_key(min)) {
+			min = curr;
+		}
+	}
+	return min;
+}
+
+static void _bucket_move_tail(struct dlink *from, struct dlink *to)
+{
+	if (list_empty(from)) {
+		return;
+	}
+	// dlist_splice expects a list without a head so we do this by hand.
+	struct dlink *first = from->next;
+	struct dlink *last = from->prev;
+	first->prev = to->prev;
+	to->prev->next = first;
+	last->next = to;
+	to->prev = last;
+	dlist_init(from);
+}
+
+static void _bucket_cascade(struct event_queue *queue, size_t bucket)
+{
+	struct dlink cascading;
+	struct dlink *head = &queue->buckets[bucket];
+	if (list_empty(head)) {
+		return;
+	}
+	// Move the nodes onto a local list first. Inserting can put nodes back into
+	// this same bucket (overflow).
+	dlist_init(&cascading);
+	_bucket_move_tail(head, &cascading);
+	if (bucket < EVENT_WHEEL_BUCKET_EXPIRED) {
+		const size_t level = bucket / EVENT_WHEEL_SLOTS;
+		const size_t slot = bucket % EVENT_WHEEL_SLOTS;
+		queue->occupied[level] &= ~((uint64_t)1 << slot);
+	}
+	while (!list_empty(&cascading)) {
+		struct event_node *node =
+			list_entry(cascading.next, struct event_node, link);
+		dlist_del(&node->link);
+		// Insert counts the node again.
+		--queue->len;
+		(void)_queue_insert(queue, node);
+	}
+}
+
+static void _bucket_unlink(struct event_queue *queue, struct event_node *node)
+{
+	dlist_del(&node->link);
+	const size_t bucket = node->wheel_bucket;
+	if (bucket < EVENT_WHEEL_BUCKET_EXPIRED &&
+	    list_empty(&queue->buckets[bucket])) {
+		const size_t level = bucket / EVENT_WHEEL_SLOTS;
+		const size_t slot = bucket % EVENT_WHEEL_SLOTS;
+		queue->occupied[level] &= ~((uint64_t)1 << slot);
+	}
+}
+
+#undef WHEEL_BUCKET
+#undef WHEEL_SLOT_INDEX
+#undef WHEEL_LEVEL_SHIFT
+#undef WHEEL_SLOT_MASK
+
+#else // EVENT_QUEUE_BACKEND == EVENT_QUEUE_BACKEND_HEAP
+
+// Index math for a 0 based binary heap.
+#define HEAP_PARENT(i) (((i) - 1) / 2)
+#define HEAP_LEFT(i) (2 * (i) + 1)
+
+// Returns true if node a should run before node b.
+static inline int _event_node_before(const struct event_node *a,
+				     const struct event_node *b);
+static inline void _heap_set(struct event_queue *queue, size_t i,
+			     struct event_node *node);
+static void _heap_sift_up(struct event_queue *queue, size_t i);
+static void _heap_sift_down(struct event_queue *queue, size_t i);
+// Doubles the heap array. Returns nonzero if realloc fails.
+static int _heap_grow(struct event_queue *queue);
+
+static int _queue_init(struct event_queue *queue)
+{
+	queue->heap_len = 0;
+	queue->sequence_next = 0;
+	queue->heap_cap = MEM_CACHE_EVENT_NODE_COUNT;
+	queue->heap = malloc(queue->heap_cap * sizeof(struct event_node *));
+	return NULL == queue->heap;
+}
+
+static int _queue_insert(struct event_queue *queue, struct event_node *node)
+{
+	if (queue->heap_len == queue->heap_cap && _heap_grow(queue)) {
+		return 1;
+	}
+	node->sequence = queue->sequence_next++;
+	const size_t i = queue->heap_len++;
+	_heap_set(queue, i, node);
+	_heap_sift_up(queue, i);
+	return 0;
+}
+
+static void _queue_remove(struct event_queue *queue, struct event_node *node)
+{
+	const size_t i = node->heap_index;
+	// Move the last node into the hole and let it float to where it belongs.
+	--queue->heap_len;
+	if (i == queue->heap_len) {
+		return;
+	}
+	_heap_set(queue, i, queue->heap[queue->heap_len]);
+	if (i > 0 && _event_node_before(queue->heap[i],
+					queue->heap[HEAP_PARENT(i)])) {
+		_heap_sift_up(queue, i);
+	} else {
+		_heap_sift_down(queue, i);
+	}
+}
+
+static int _heap_grow(struct event_queue *queue)
+{
+	const size_t cap = 2 * queue->heap_cap;
+	struct event_node **grown =
+		realloc(queue->heap, cap * sizeof(struct event_node *));
+	if (NULL == grown) {
+		printf("Failed to grow the event heap to %zu\n", cap);
+		return 1;
+	}
+	queue->heap = grown;
+	queue->heap_cap = cap;
+	return 0;
+}
+
+static struct event_node *_queue_first(struct event_queue *queue)
 {
-	if (NULL == queue || list_empty(&queue->event_head)) {
+	if (0 == queue->heap_len) {
 		return NULL;
 	}
-	return list_entry(queue->event_head.next, struct event_node, link);
+	return queue->heap[0];
 }
+
+static void _queue_advance(struct event_queue *queue, uint64_t now_ms)
+{
+	// The heap is always ordered. Nothing to do.
+}
+
+static inline int _event_node_before(const struct event_node *a,
+				     const struct event_node *b)
+{
+	const uint64_t a_key = _event_node_key(a);
+	const uint64_t b_key = _event_node_key(b);
+	if (a_key != b_key) {
+		return a_key < b_key;
+	}
+	return a->sequence < b->sequence;
+}
+
+static inline void _heap_set(struct event_queue *queue, size_t i,
+			     struct event_node *node)
+{
+	queue->heap[i] = node;
+	node->heap_index = i;
+}
+
+static void _heap_sift_up(struct event_queue *queue, size_t i)
+{
+	struct event_node *node = queue->heap[i];
+	// Shift parents down instead of swapping so each level is one write.
+	while (i > 0) {
+		struct event_node *parent = queue->heap[HEAP_PARENT(i)];
+		if (!_event_node_before(node, parent)) {
+			break;
+		}
+		_heap_set(queue, i, parent);
+		i = HEAP_PARENT(i);
+	}
+	_heap_set(queue, i, node);
+}
+
+static void _heap_sift_down(struct event_queue *queue, size_t i)
+{
+	struct event_node *node = queue->heap[i];
+	const size_t len = queue->heap_len;
+	while (HEAP_LEFT(i) < len) {
+		size_t child = HEAP_LEFT(i);
+		if (child + 1 < len &&
+		    _event_node_before(queue->heap[child + 1],
+				       queue->heap[child])) {
+			child = child + 1;
+		}
+		if (!_event_node_before(queue->heap[child], node)) {
+			break;
+		}
+		_heap_set(queue, i, queue->heap[child]);
+		i = child;
+	}
+	_heap_set(queue, i, node);
+}
+
+#undef HEAP_LEFT
+#undef HEAP_PARENT
+
+#endif // EVENT_QUEUE_BACKEND
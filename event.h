@@ -6,21 +6,45 @@
 
 #include <curl/curl.h>
 
+#include "config.h"
 #include "equity.h"
 #include "kette.h"
 #include "portfolio.h"
+#include "quote_scan.h"
+#include "sse_scan.h"
 
 enum event_tag {
+	TECZKA_EVENT_PORTFOLIO_IMPORTED,
 	TECZKA_EVENT_FETCH_STOCK,
+	TECZKA_EVENT_FETCH_HEDGE,
+	TECZKA_EVENT_STREAM_CONNECT,
 	TECZKA_EVENT_DISPLAY_STOCK,
 	TECZKA_EVENT_DISPLAY_PORTFOLIO,
 	TECZKA_EVENT_CURL_TIMEOUT,
 };
 
+// Posted by the thread importing portfolio once it's done. Fetching starts then.
+struct event_portfolio_imported {
+	struct portfolio *portfolio;
+};
+
+// Fetches the quotes of every equity in stock's fetch_partition.
 struct event_stock_fetch {
 	struct equity *stock;
 };
 
+struct event_io_curl;
+
+// Sends a duplicate of event_io's transfer if it's still running.
+struct event_fetch_hedge {
+	struct event_io_curl *event_io;
+};
+
+// Opens the quote stream for every equity in portfolio. See EVENT_QUOTE_STREAM.
+struct event_stream_connect {
+	struct portfolio *portfolio;
+};
+
 struct event_stock_display {
 	struct equity *stock;
 	struct equity *stock_next; // For queuing next stock display
@@ -34,40 +58,283 @@ struct event_curl_timeout {
 	CURLM *multi_handle;
 };
 
+enum event_flags {
+	// The dispatcher puts the event back in the queue period_ms after its run
+	// time instead of freeing it.
+	EVENT_FLAG_PERIODIC = (1 << 0),
+};
+
 // Tagged union of events and the time they should be executed.
 struct event {
 	enum event_tag tag;
+	uint32_t flags;
+	uint32_t period_ms; // Only used with EVENT_FLAG_PERIODIC
 	uint64_t run_timestamp_ms; // When event needs to be executed
+	// Only used with EVENT_FLAG_PERIODIC. When this period's run is due before
+	// jitter. Periods are counted from here so jitter never shifts the phase.
+	uint64_t period_base_ms;
 	union {
+		struct event_portfolio_imported portfolio_imported_info;
 		struct event_stock_fetch stock_fetch_info;
+		struct event_fetch_hedge fetch_hedge_info;
+		struct event_stream_connect stream_connect_info;
 		struct event_stock_display stock_display_info;
 		struct event_portfolio_display portfolio_display_info;
 		struct event_curl_timeout curl_timeout_info;
 	};
 };
 
+/* Priority classes. Inside a class, events run in run_timestamp_ms order. A higher
+ * class event (lower value) due within EVENT_PRIORITY_SLACK_MS per class of a
+ * lower class event runs first, so a redraw never holds up a fetch that's about to
+ * be due. The class comes from the tag so every event gets one without callers
+ * having to remember to set it.
+ */
+enum event_priority {
+	EVENT_PRIORITY_NETWORK = 0,
+	EVENT_PRIORITY_DATA,
+	EVENT_PRIORITY_RENDER,
+};
+
+static inline enum event_priority event_priority_get(const struct event *event)
+{
+	switch (event->tag) {
+	case TECZKA_EVENT_FETCH_STOCK:
+	case TECZKA_EVENT_FETCH_HEDGE:
+	case TECZKA_EVENT_STREAM_CONNECT:
+	case TECZKA_EVENT_CURL_TIMEOUT:
+		return EVENT_PRIORITY_NETWORK;
+	case TECZKA_EVENT_PORTFOLIO_IMPORTED:
+		return EVENT_PRIORITY_DATA;
+	case TECZKA_EVENT_DISPLAY_STOCK:
+	case TECZKA_EVENT_DISPLAY_PORTFOLIO:
+		return EVENT_PRIORITY_RENDER;
+	default:
+		return EVENT_PRIORITY_DATA;
+	}
+}
+
+/* Returns the object an event acts on. Two pending events with the same tag and
+ * target do the same work so the event queue coalesces them.
+ */
+static inline const void *event_target_get(const struct event *event)
+{
+	switch (event->tag) {
+	case TECZKA_EVENT_PORTFOLIO_IMPORTED:
+		return event->portfolio_imported_info.portfolio;
+	case TECZKA_EVENT_FETCH_STOCK:
+		return event->stock_fetch_info.stock;
+	case TECZKA_EVENT_FETCH_HEDGE:
+		return event->fetch_hedge_info.event_io;
+	case TECZKA_EVENT_STREAM_CONNECT:
+		return event->stream_connect_info.portfolio;
+	case TECZKA_EVENT_DISPLAY_STOCK:
+		return event->stock_display_info.stock;
+	case TECZKA_EVENT_DISPLAY_PORTFOLIO:
+		return event->portfolio_display_info.portfolio;
+	case TECZKA_EVENT_CURL_TIMEOUT:
+		return event->curl_timeout_info.multi_handle;
+	default:
+		return NULL;
+	}
+}
+
+_Static_assert(QUOTE_BATCH_SYMBOLS_MAX <= 64,
+	       "event_io_curl tracks a batch's quotes in a uint64_t");
+
+/* fetch_partition is a fixed run of consecutive equities in the portfolio, at most
+ * QUOTE_BATCH_SYMBOLS_MAX of them. A fetch always batches the whole partition in
+ * portfolio order so it requests the same URL every time. That lets the
+ * validators (ETag and Last-Modified) of the partition's last 200 be sent back on
+ * every fetch after it. Whether those come back as 304s is up to the provider: a
+ * single changed quote in the partition means a 200. Empty strings mean the
+ * response didn't have one.
+ */
+struct fetch_partition {
+	struct equity *stocks[QUOTE_BATCH_SYMBOLS_MAX];
+	size_t stocks_len;
+	char etag[QUOTE_VALIDATOR_BYTES_MAX + 1];
+	char last_modified[QUOTE_VALIDATOR_BYTES_MAX + 1];
+};
+
 struct event_io_curl {
+	// Handle of the transfer in flight or NULL if the slot is free.
 	CURL *easy_handle;
+	// Easy handle the slot reuses for every transfer. Everything but the URL is set
+	// once so its connection, DNS and TLS state carry over between fetches.
+	CURL *easy_handle_pooled;
+	// Request URL. Rebuilt for each transfer since hedges go to another host.
+	char url[QUOTE_PROVIDER_URL_BYTES_MAX];
+	// Socket CURL last reported for the transfer. Transfers multiplexed over one
+	// connection share it.
 	curl_socket_t sockfd;
-	struct event *event;
+	// Copy of the event that started the transfer. The event's node goes back to
+	// the cache once the transfer starts.
+	struct event event;
+	uint64_t started_ms;
+	// The other transfer fetching the same batch if this one was hedged. The
+	// first to finish cancels the other. hedge is set on the duplicate.
+	struct event_io_curl *hedge_partner;
+	int hedge;
+	// The partition the transfer fetches.
+	struct fetch_partition *partition;
+	// If the partition has validators, these headers carry them and are linked in
+	// front of the shared request headers. They live in the slot so a conditional
+	// request doesn't allocate.
+	char if_none_match[sizeof("If-None-Match: ") + QUOTE_VALIDATOR_BYTES_MAX];
+	char if_modified_since[sizeof("If-Modified-Since: ") +
+			       QUOTE_VALIDATOR_BYTES_MAX];
+	struct curl_slist conditional_headers[2];
+	// Status and validators of the response. The header callback fills in the
+	// validators. Empty if the response didn't have one or it was too long.
+	long response_status;
+	char response_etag[QUOTE_VALIDATOR_BYTES_MAX + 1];
+	char response_last_modified[QUOTE_VALIDATOR_BYTES_MAX + 1];
+	// Every equity the transfer fetches quotes for. The first is the stock from
+	// event. Bit i of stocks_quoted is set once records[i] holds the quote
+	// for stocks[i].
+	struct equity *stocks[QUOTE_BATCH_SYMBOLS_MAX];
+	size_t stocks_len;
+	uint64_t stocks_quoted;
+	// Quotes scanned from the body so far. They're only applied once the
+	// transfer finished with a 2xx so a response cut off halfway doesn't
+	// leave part of the batch updated and never redrawn.
+	struct quote_record records[QUOTE_BATCH_SYMBOLS_MAX];
+	// Where _quote_record_keep starts looking for a record's equity. The
+	// provider answers in request order so this is almost always a hit.
+	size_t stocks_cursor;
+	// Response body. buffer points into the loop's response arena and is only
+	// reset between transfers, never freed.
 	struct data_buffer buffer;
+	// Set by the write callback when the body didn't fit in buffer. The transfer
+	// is aborted when this happens.
+	int buffer_overflow;
+	// The write callback feeds every chunk through this as it arrives so the
+	// quote is parsed by the time the transfer finishes.
+	struct quote_scan quote_scan;
+	// Splits the quote stream into events for quote_scan. Only the stream uses it.
+	struct sse_scan sse_scan;
 };
 
+_Static_assert((EVENT_QUEUE_INDEX_SLOTS & (EVENT_QUEUE_INDEX_SLOTS - 1)) == 0,
+	       "EVENT_QUEUE_INDEX_SLOTS must be a power of two");
+
+#if EVENT_QUEUE_BACKEND == EVENT_QUEUE_BACKEND_WHEEL
+#define EVENT_WHEEL_SLOTS (1 << EVENT_WHEEL_SLOT_BITS)
+// Besides one bucket per slot, the wheel has a bucket for events that are already
+// due and one for events too far out for the top level.
+#define EVENT_WHEEL_BUCKET_EXPIRED (EVENT_WHEEL_LEVELS * EVENT_WHEEL_SLOTS)
+#define EVENT_WHEEL_BUCKET_OVERFLOW (EVENT_WHEEL_BUCKET_EXPIRED + 1)
+#define EVENT_WHEEL_BUCKET_COUNT (EVENT_WHEEL_BUCKET_OVERFLOW + 1)
+
+// The occupied bitmaps are uint64_t.
+_Static_assert(EVENT_WHEEL_SLOT_BITS <= 6,
+	       "EVENT_WHEEL_SLOT_BITS must be <= 6");
+_Static_assert(EVENT_WHEEL_LEVELS * EVENT_WHEEL_SLOT_BITS < 64,
+	       "Timing wheel span must fit in a uint64_t");
+#endif
+
 struct event_node {
-	struct slink link;
+#if EVENT_QUEUE_BACKEND == EVENT_QUEUE_BACKEND_WHEEL
+	// Link into one of the wheel's buckets and the index of that bucket. We
+	// need the bucket to clear its occupied bit when it goes empty.
+	struct dlink link;
+	size_t wheel_bucket;
+#else
+	// Position of the node in the queue's heap. Lets us remove or reposition a node
+	// without searching for it.
+	size_t heap_index;
+	// Insertion order. Ties on run_timestamp_ms are broken with this so events that
+	// should run at the same time keep FIFO order.
+	uint64_t sequence;
+#endif
+	// Links periodic nodes the loop couldn't put back in the queue so it can try
+	// again. NULL otherwise.
+	struct event_node *requeue_next;
 	struct event event;
 };
 
+#if EVENT_QUEUE_BACKEND == EVENT_QUEUE_BACKEND_WHEEL
+/* event_queue is a hierarchical timing wheel. An event lives in the lowest level
+ * whose span covers the distance between its queue key (see event_priority) and
+ * now_ms, so add and remove are O(1). event_queue_advance moves now_ms forward,
+ * jumping over empty slots with the occupied bitmaps and cascading higher level
+ * slots down as they are reached. Each event cascades at most EVENT_WHEEL_LEVELS
+ * times so advancing is amortized O(1) per event.
+ */
+struct event_queue {
+	struct dlink buckets[EVENT_WHEEL_BUCKET_COUNT];
+	// Bit i of occupied[l] is set if slot i of level l is not empty.
+	uint64_t occupied[EVENT_WHEEL_LEVELS];
+	// Every event whose queue key (run_timestamp_ms plus the priority slack) is
+	// <= now_ms is in the expired bucket.
+	uint64_t now_ms;
+	size_t len;
+#else
+/* event_queue is a binary min-heap of event_node pointers keyed on
+ * (run_timestamp_ms plus the priority slack, sequence). The heap is an array so
+ * add and dequeue are O(log n) and peek is O(1).
+ */
 struct event_queue {
-	struct slink event_head;
+	// Starts with room for MEM_CACHE_EVENT_NODE_COUNT nodes and doubles whenever
+	// the node cache hands out more than that.
+	struct event_node **heap;
+	size_t heap_len;
+	size_t heap_cap;
+	uint64_t sequence_next;
+#endif
+	// Open addressing hash index from (tag, target) to the pending node for it.
+	// This lets a new event for the same target reuse the pending node instead of
+	// queueing a duplicate.
+	struct event_node *index[EVENT_QUEUE_INDEX_SLOTS];
+	size_t index_len;
 	// There can only be one outstanding curl_timeout so we'll keep it here.
 	// We need to check this often anyway.
 	struct event curl_timeout_event;
 };
 
+// Returns nonzero if queue is NULL or the heap couldn't be allocated.
 int event_queue_init(struct event_queue *queue);
+/* Adds event to the queue. If no other node is pending for the event's tag and
+ * target, the node is indexed so event_queue_pending_get can find it.
+ * Returns nonzero if queue or event is NULL or the heap couldn't grow.
+ */
 int event_queue_add(struct event_queue *queue, struct event_node *event);
+/* Dequeue and peek return the node with the lowest key, which is run_timestamp_ms
+ * plus EVENT_PRIORITY_SLACK_MS for each class below EVENT_PRIORITY_NETWORK. That
+ * node isn't always the one with the earliest run_timestamp_ms.
+ */
 const struct event_node *event_queue_dequeue(struct event_queue *queue);
 const struct event_node *event_queue_peek(struct event_queue *queue);
+// Removes a node that is in the queue. Returns nonzero if queue or event is NULL.
+int event_queue_remove(struct event_queue *queue, struct event_node *event);
+/* Tells the queue the current time. The timing wheel uses this to move due events
+ * to the front of the queue. The heap ignores it. Call this with timestamp_ms_get()
+ * before peeking or dequeuing due events.
+ */
+void event_queue_advance(struct event_queue *queue, uint64_t now_ms);
+/* Dequeues every event due by now_ms in one pass, up to max of them. This also
+ * advances the queue to now_ms. Events come out in the same order
+ * event_queue_dequeue would return them. It stops at the first node that isn't
+ * due, so a due lower class event waits for higher class events ahead of it.
+ * @param out: Array the dequeued nodes are written to. The caller owns them after this.
+ * @param max: Length of out.
+ * @returns The number of nodes written to out. If this equals max there may be more
+ * due events left in the queue.
+ */
+size_t event_queue_dequeue_due(struct event_queue *queue, uint64_t now_ms,
+			       struct event_node *out[], size_t max);
+/* Returns the node pending in the queue for the tag and target (see
+ * event_target_get) or NULL if there is none. This is O(1) on average.
+ */
+struct event_node *event_queue_pending_get(struct event_queue *queue,
+					   enum event_tag tag,
+					   const void *target);
+/* Moves a node that is in the queue to a new run time. The node keeps its place
+ * in the index.
+ * Returns nonzero if queue or event is NULL.
+ */
+int event_queue_reschedule(struct event_queue *queue, struct event_node *event,
+			   uint64_t run_timestamp_ms);
 
 #endif // _TECZKA_EVENT_H
@@ -1,23 +1,69 @@
+// Needed for struct itimerspec and CLOCK_BOOTTIME with -std=c11.
+#define _POSIX_C_SOURCE 199309L
+
 #include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <curl/multi.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
 
 #include "config.h"
 #include "curl_callbacks.h"
 #include "event.h"
 #include "event_loop.h"
+#include "event_ring.h"
+#include "kette.h"
+#include "portfolio.h"
+#include "quote_scan.h"
+#include "sse_scan.h"
 #include "static_mem_cache.h"
+#include "uring.h"
+#include "util.h"
+
+// Runtime estimate for one event type in microseconds. The EWMA follows the typical
+// runtime. The max is the worst case we plan around. It decays toward the EWMA so
+// one slow outlier doesn't pessimize scheduling forever.
+struct event_runtime_estimate_us {
+	uint64_t ewma;
+	uint64_t max;
+};
+
+// A batch of transfer slots along with the response regions they own. The first
+// chunk is static. The rest are allocated when every slot is busy.
+struct event_io_chunk {
+	struct event_io_curl slots[EVENT_IO_CURL_BUFFER_LEN];
+	char response_arena[EVENT_IO_CURL_BUFFER_LEN]
+			   [EVENT_IO_CURL_RESPONSE_BYTES];
+};
+#define EVENT_IO_CHUNKS_MAX (EVENT_IO_CURL_SLOTS_MAX / EVENT_IO_CURL_BUFFER_LEN)
+_Static_assert(EVENT_IO_CURL_SLOTS_MAX % EVENT_IO_CURL_BUFFER_LEN == 0,
+	       "Transfer slots are added EVENT_IO_CURL_BUFFER_LEN at a time");
+// The stream asks for every ticker in the portfolio at once.
+#define QUOTE_STREAM_URL_BYTES_MAX         \
+	(sizeof(QUOTE_STREAM_URL_PREFIX) + \
+	 MEM_CACHE_EQUITY_NODE_COUNT * (EQUITY_KEY_BYTES_MAX + 1))
 
 // Being precise for the curl_timeout event is important. We'll keep a struct for
 // tracking the max time each event takes to run. If curl_timeout needs to be handled
 // before the highest priority event will finish (just a guess), then we need to know.
 struct event_runtime_max_ms {
-	uint64_t stock_fetch;
-	uint64_t stock_display;
-	uint64_t portfolio_display;
+	struct event_runtime_estimate_us stock_fetch;
+	struct event_runtime_estimate_us fetch_hedge;
+	struct event_runtime_estimate_us stream_connect;
+	struct event_runtime_estimate_us portfolio_imported;
+	struct event_runtime_estimate_us stock_display;
+	struct event_runtime_estimate_us portfolio_display;
 };
 
 /* There can only be one event loop in the applicaton because it is single threaded.
@@ -25,60 +71,388 @@ struct event_runtime_max_ms {
  * globals in this file. I generally dislike using global variables but I think in
  * this case it makes the most sense.
  */
-static int epoll_fd = -1;
 static CURLM *curl_multi_handle = NULL;
+static int curl_running_handles = 0;
+// Every pooled easy handle shares DNS lookups and TLS sessions through this. The
+// connection cache is the multi handle's so CURLMOPT_MAXCONNECTS applies to it.
+static CURLSH *curl_share_handle = NULL;
+static struct curl_slist *curl_request_headers = NULL;
+// Other threads post events into this ring. They are the only state in this file
+// touched off the loop thread. wake_fd is an eventfd the backend watches that posters
+// write to so a sleeping loop wakes up and drains the ring. wake_pending keeps
+// posters from writing it again until the loop has drained, so a burst of posts
+// costs one write.
+static struct event_ring event_inject_ring;
+static int wake_fd = -1;
+static atomic_int wake_pending = 0;
 // Curl may require our application to listen to sockets that are internal to CURL. This
-// means the event_io_inflight array may not contain all of the sockets epoll is actually
-// listening to. We could epoll_ctl add on each socket callback and retry with mod if
-// epoll returns EEXIST but then we are doing 2 syscalls. It would be much faster to just
-// linearly search an array that fits in a couple cache lines.
-static int epoll_fd_arr[EVENT_LOOP_FDS_MAX] = { -1 };
-
-// Setting this to 0 because I'm unsure what epoll_wait expects. This is the safest
-// option.
-static struct epoll_event epoll_wait_events[EVENT_LOOP_EPOLL_EVENTS_LEN] = { 0 };
-// Setting this to 0 because this ensures the application will see they are all empty
-// on init.
-static struct event_io_curl event_io_inflight[EVENT_IO_CURL_BUFFER_LEN] = { 0 };
+// means the transfer slots may not contain all of the sockets the backend is actually
+// listening to. Instead we keep the epoll events each fd is registered for, indexed by
+// fd. That tells the socket callback whether to add or mod without a failed syscall,
+// and lets it skip epoll_ctl entirely when CURL asks for what's already registered.
+// 0 means the fd isn't registered. Sized from RLIMIT_NOFILE in _fd_table_init.
+static uint8_t *poll_fd_masks = NULL;
+static size_t poll_fd_masks_len = 0;
+// fds with a nonzero mask.
+static size_t poll_fds_registered = 0;
+// Set in every registered fd's mask so an fd registered for no events isn't 0.
+#define POLL_FD_REGISTERED (1u << 7)
+_Static_assert(((EVENT_LOOP_FD_POLL_IN | EVENT_LOOP_FD_POLL_OUT) &
+		~(POLL_FD_REGISTERED - 1)) == 0,
+	       "Poll flags must fit below POLL_FD_REGISTERED");
+
+// io_uring's multishot polls, like EPOLLET, only report a fd when it becomes
+// ready.
+#define POLL_EDGE_TRIGGERED                                   \
+	(EVENT_LOOP_BACKEND == EVENT_LOOP_BACKEND_IO_URING || \
+	 EVENT_LOOP_EPOLL_EDGE_TRIGGERED)
+
+#if EVENT_LOOP_BACKEND == EVENT_LOOP_BACKEND_IO_URING
+// Registration changes queue SQEs that go in with the next wait, so each loop
+// iteration costs one io_uring_enter however many sockets changed. The wait's
+// timeout is the earliest deadline so there's no timerfd.
+static struct uring uring;
+// Every poll armed for a fd takes the fd's next generation and carries it in the
+// high half of its user_data. Completions from a poll that was removed or replaced
+// since have an old generation and are dropped.
+static uint32_t *uring_fd_generations = NULL;
+// user_data of wake_fd's poll and of SQEs whose completions we don't care about.
+#define URING_USER_DATA_WAKE (UINT64_MAX)
+#define URING_USER_DATA_IGNORE (UINT64_MAX - 1)
+#else
+static int epoll_fd = -1;
+// One timerfd covers every deadline the loop has: the head of event_queue and
+// CURL's timeout. It is in the epoll set so a single epoll_wait sleeps until either
+// a socket is ready or the earliest deadline passes. It uses CLOCK_BOOTTIME so its
+// absolute times are the same as timestamp_ms_get.
+static int timer_fd = -1;
+// Deadline the timerfd is armed for. UINT64_MAX means it is disarmed. We keep it
+// so we only call timerfd_settime when the earliest deadline changes.
+static uint64_t timer_fd_armed_ms = UINT64_MAX;
+// Where epoll_wait reports ready fds. Grown in _event_loop_poll so one call can
+// report every registered fd. Zeroed because I'm unsure what epoll_wait expects.
+// This is the safest option.
+static struct epoll_event *epoll_wait_events = NULL;
+static size_t epoll_wait_events_len = 0;
+#endif
+// Response bodies land in the chunk's arena. Each slot owns one region for the life
+// of the program so receiving a quote never allocates. Zeroed so every slot starts
+// out free.
+static struct event_io_chunk event_io_chunk_static = { 0 };
+static struct event_io_chunk *event_io_chunks[EVENT_IO_CHUNKS_MAX] = { 0 };
+static size_t event_io_chunks_len = 0;
+// The quote stream's transfer. It lives outside the slot table since it never ends
+// while things are going well and the fetch limit doesn't apply to it. It doesn't
+// keep its body so it has no response region.
+static struct event_io_curl quote_stream_io = { 0 };
+static char quote_stream_url[QUOTE_STREAM_URL_BYTES_MAX];
+#if EVENT_QUOTE_STREAM
+#define PREWARM_URL QUOTE_STREAM_URL_PREFIX
+#define PREWARM_LEN (1)
+#else
+#define PREWARM_URL QUOTE_PROVIDER_URL_PREFIX
+#define PREWARM_LEN (EVENT_PREWARM_CONNECTIONS)
+#endif
+_Static_assert(EVENT_PREWARM_CONNECTIONS >= 1,
+	       "EVENT_PREWARM_CONNECTIONS must be at least 1");
+// HEAD requests that open connections while the portfolio is imported. The
+// connections stay in the multi handle's cache for the fetches to pick up.
+static struct event_io_curl prewarm_io[PREWARM_LEN] = { 0 };
+static size_t prewarm_pending = 0;
+// Nothing is fetched until the portfolio is imported and no connection is still
+// warming up.
+static int portfolio_imported = 0;
+static int loop_seeded = 0;
+// Free transfer slots. The last one freed is handed out first so the same few slots
+// (and their connections) stay warm when load is light.
+static struct event_io_curl *event_io_free[EVENT_IO_CURL_SLOTS_MAX] = { 0 };
+static size_t event_io_free_len = 0;
+// AIMD limit on fetches in flight. See EVENT_FETCH_LATENCY_TARGET_MS.
+static uint32_t fetch_limit = EVENT_IO_CURL_BUFFER_LEN;
+static uint32_t fetch_inflight = 0;
+// Fast fetches since the limit last went up. It goes up when this reaches it.
+static uint32_t fetch_limit_credit = 0;
+// When the limit was last halved. Fetches started before this were already in
+// flight when it was cut so one bad stretch only cuts it once.
+static uint64_t fetch_limit_cut_ms = 0;
+// Stocks waiting for the fetch limit. Each stock is in here at most once so it
+// can't hold more than every equity.
+static struct equity *fetch_deferred[MEM_CACHE_EQUITY_NODE_COUNT];
+static size_t fetch_deferred_head = 0;
+static size_t fetch_deferred_len = 0;
+// Latency of the last EVENT_FETCH_LATENCY_SAMPLES successful fetches and how long a
+// fetch runs before it's hedged. UINT64_MAX until there are enough samples.
+static uint32_t fetch_latency_ms[EVENT_FETCH_LATENCY_SAMPLES];
+static size_t fetch_latency_len = 0;
+static size_t fetch_latency_next = 0;
+static uint64_t fetch_hedge_after_ms = UINT64_MAX;
+// Hedge budget in hundredths of a hedge. Every fetch adds
+// EVENT_FETCH_HEDGE_BUDGET_PERCENT and a hedge spends 100.
+static uint32_t fetch_hedge_tokens = 0;
+_Static_assert(sizeof(QUOTE_PROVIDER_HEDGE_URL_PREFIX) <=
+		       sizeof(QUOTE_PROVIDER_URL_PREFIX),
+	       "Hedged URLs have to fit in event_io_curl's url");
+// Every equity's fetch partition. Built when the loop is seeded.
+static struct fetch_partition
+	fetch_partitions[(MEM_CACHE_EQUITY_NODE_COUNT + QUOTE_BATCH_SYMBOLS_MAX - 1) /
+			 QUOTE_BATCH_SYMBOLS_MAX];
 static struct event_node EVENT_NODE_STATIC_BUFFER[MEM_CACHE_EVENT_NODE_COUNT];
+static uint64_t EVENT_NODE_ALLOCATED_BITMAP[STATIC_MEM_CACHE_BITMAP_WORDS(
+	MEM_CACHE_EVENT_NODE_COUNT)];
 static struct static_mem_cache event_node_cache;
 static struct event_queue event_queue;
 
 static struct teczka_curl_socket_callback_context socket_callback_context;
 
 static struct event_runtime_max_ms runtimes = { 0 };
+static struct event_loop_context *loop_context = NULL;
+// xorshift state for periodic event jitter. Seeded when the loop starts.
+static uint64_t jitter_state = 0;
+// Periodic nodes that couldn't go back in the queue. They're retried every
+// EVENT_FETCH_STOCK_RETRY_MS until they fit. Dropping one would stop its ticker
+// for good.
+static struct event_node *requeue_deferred = NULL;
+static uint64_t requeue_retry_ms = UINT64_MAX;
 
 static enum event_loop_init_error _queue_init(void);
 
-// Internal functions
+// Dispatcher functions
+// Schedules the first fetch for every equity and the first portfolio display.
+static void _event_loop_seed(struct event_loop_context *context);
+// Returns true while there are events queued or CURL has work in progress.
+static int _event_loop_has_work(void);
+// Seeds the loop once the portfolio is imported and no connection is warming up.
+static void _event_loop_seed_try(void);
+// Order the dispatcher runs a batch of due events in. This follows the priority
+// classes. Fetches go first so their network time overlaps the display work after
+// them.
+static const enum event_tag EVENT_DISPATCH_ORDER[] = {
+	TECZKA_EVENT_PORTFOLIO_IMPORTED,
+	TECZKA_EVENT_FETCH_STOCK,
+	TECZKA_EVENT_FETCH_HEDGE,
+	TECZKA_EVENT_STREAM_CONNECT,
+	TECZKA_EVENT_DISPLAY_STOCK,
+	TECZKA_EVENT_DISPLAY_PORTFOLIO,
+};
+// Runs every event that is due. Due events are pulled from the queue in batches
+// with one clock read and run grouped by type.
+static void _event_loop_dispatch_due(void);
+/* Runs the events in due with the given tag and returns the time after they ran.
+ * CURL is serviced first if the group's worst case runtime could run past CURL's
+ * deadline. The group is timed as a whole to update the runtime estimate. Nodes
+ * that ran are freed and set to NULL in due. Render events that are too late are
+ * dropped instead of run (see _event_render_drop).
+ */
+static uint64_t _event_group_run(enum event_tag tag, struct event_node *due[],
+				 size_t due_len, uint64_t now_ms);
+static void _event_run(const struct event *event);
+// Returns true if event is a render event so late that the loop must be overloaded.
+// Skipping it gives the time back to network and data work.
+static int _event_render_drop(const struct event *event, uint64_t now_ms);
+/* Puts a periodic event's node back in the queue one period after its run time,
+ * skipping periods we fell too far behind to make. The node is reused so a periodic
+ * event never goes back through the cache.
+ */
+static void _event_periodic_requeue(struct event_node *node, uint64_t now_ms);
+/* Puts the node in the queue or merges it into the node pending for the same work.
+ * @returns EVENT_LOOP_SCHEDULE_ERROR_OK, EVENT_LOOP_SCHEDULE_ERROR_COALESCED if the
+ * node was merged and freed, or EVENT_LOOP_SCHEDULE_ERROR_EVENT_CACHE_OOM if the
+ * queue couldn't grow. The caller still owns the node then.
+ */
+static enum event_loop_schedule_error
+_event_node_requeue(struct event_node *node);
+// Tries to requeue every deferred periodic node.
+static void _event_requeue_deferred_retry(uint64_t now_ms);
+// Folds event into the node already pending for the same tag and target. The node
+// keeps the earlier run time and becomes periodic if event is.
+static void _event_coalesce(struct event_node *pending,
+			    const struct event *event);
+/* Moves a periodic event's period_base_ms to its next period and returns when it
+ * should run, which is the new base with jitter applied. Periods we are already
+ * past are skipped.
+ */
+static uint64_t _event_periodic_next(struct event *event, uint64_t now_ms);
+// Moves run_timestamp_ms up to EVENT_PERIODIC_JITTER_MS / 2 either way without
+// putting it before now_ms.
+static uint64_t _event_jitter_apply(uint64_t run_timestamp_ms, uint64_t now_ms);
+static void _event_portfolio_imported_run(const struct event *event);
+static void _event_stock_fetch_run(const struct event *event);
+// Sends a duplicate of a slow transfer to the hedge host if the budget allows.
+static void _event_fetch_hedge_run(const struct event *event);
+/* Writes url_prefix and the batch's symbols to event_io's URL and hands the
+ * transfer to CURL. event_io's stocks must be filled in.
+ * @returns 0 if the transfer is in flight. Otherwise the slot was released again.
+ */
+static int _event_io_transfer_start(struct event_io_curl *event_io,
+				    const struct event *event,
+				    const char *url_prefix);
+// Sets the transfer's request headers. The partition's validators go along as
+// If-None-Match and If-Modified-Since.
+static void _event_io_headers_set(struct event_io_curl *event_io);
+// Whether the transfer finished with an answer: quotes in a 2xx or a 304 saying
+// nothing changed. Quotes scanned before a failure don't count.
+static int _event_io_answered(const struct event_io_curl *event_io,
+			      CURLcode result);
+// Fills in the transfer's stocks with every equity in stock's partition.
+static void _fetch_batch_gather(struct event_io_curl *event_io,
+				const struct equity *stock);
+// Starts the quote stream. If it can't be started, tries again later.
+static void _event_stream_connect_run(const struct event *event);
+// Logs why the quote stream ended and schedules a reconnect.
+static void _quote_stream_done(CURLcode result);
+// Starts the HEAD requests on every prewarm handle.
+static void _connections_prewarm(void);
+static int _event_io_prewarm_is(const struct event_io_curl *event_io);
+static void _connection_prewarm_done(struct event_io_curl *event_io,
+				     CURLcode result);
+static void _event_stock_display_run(const struct event *event);
+static void _event_portfolio_display_run(const struct event *event);
+// Writes cents as a dollar string like -12.34. positive_sign is printed in front of
+// values >= 0.
+#define CENTS_STRING_BYTES (32)
+static void _cents_format(char buf[CENTS_STRING_BYTES], int64_t cents,
+			  const char *positive_sign);
+static struct event_runtime_estimate_us *
+_event_runtime_estimate_get(enum event_tag tag);
+static void _event_runtime_record(enum event_tag tag, uint64_t runtime_us);
+// Calls curl_multi_socket_action for CURL's timeout and clears the deadline. CURL
+// sets a new one through teczka_curl_timer_callback if it needs to.
+static void _curl_timeout_service(void);
+// Handles transfers CURL reports as done, then starts deferred fetches that fit
+// under the limit.
+static void _curl_transfers_check(void);
+static void _curl_transfer_done(struct event_io_curl *event_io, CURLcode result);
+/* Takes the transfer out of CURL and puts its slot back on the free stack. Its
+ * pending hedge is cancelled and a hedge partner is left to finish on its own.
+ */
+static void _event_io_transfer_release(struct event_io_curl *event_io);
+// Records a successful fetch's latency and updates fetch_hedge_after_ms.
+static void _fetch_latency_record(curl_off_t total_us);
+// Adjusts fetch_limit for a transfer CURL finished. Call before it's marked done.
+static void _fetch_limit_update(const struct event_io_curl *event_io,
+				CURLcode result);
+/* Queues stock's fetch until one in flight finishes.
+ * @returns 0 if it was queued or already was, 1 if the FIFO is full.
+ */
+static int _fetch_defer(struct equity *stock);
+static void _fetch_deferred_start(void);
+/* quote_scan record callback. Keeps the record in the transfer's records if it
+ * is for one of its equities. _curl_transfer_done applies them. This runs
+ * inside CURL's write callback so it must not call CURL.
+ */
+static void _quote_record_keep(const struct quote_record *record,
+			       void *event_io_ptr);
+/* quote_scan record callback for the stream. Updates the record's equity in the
+ * portfolio and schedules its redraw. Must not call CURL either.
+ */
+static void _quote_stream_record_apply(const struct quote_record *record,
+				       void *portfolio_ptr);
+// Stores a quote record's values in stock's valuation and updates its deltas.
+static void _equity_quote_apply(struct equity *stock,
+				const struct quote_record *record);
+// How much of a response body to print when it had no quote in it.
+#define RESPONSE_LOG_BYTES_MAX (120)
+// Pops a free transfer slot. Adds a chunk of slots if none are free and there's
+// room. Returns NULL if every slot is busy.
+static struct event_io_curl *_event_io_slot_get(void);
+static void _event_io_slot_put(struct event_io_curl *event_io);
+/* Sets up every slot in chunk and pushes them on the free stack. A slot that fails
+ * to set up is left out. chunk is added to event_io_chunks so cleanup finds it.
+ */
+static enum event_loop_init_error
+_event_io_chunk_add(struct event_io_chunk *chunk);
+// Gives a slot its response region and an easy handle with every option but the
+// URL set.
 static enum event_loop_init_error
-_curl_init(struct event_io_curl *event_io_array);
+_event_io_slot_init(struct event_io_curl *event_io, char *response_region);
+
+// Internal functions
+static enum event_loop_init_error _curl_init(void);
 static int _curl_socket_setopts(void);
 static int _curl_timer_setopts(void);
+// Creates the share handle and the request headers, then the first chunk of slots.
+static enum event_loop_init_error _curl_pool_init(void);
+// Sets up quote_stream_io's easy handle for streaming.
+static enum event_loop_init_error _quote_stream_init(void);
+// Sets up the prewarm handles to send a HEAD request to PREWARM_URL.
+static enum event_loop_init_error _prewarm_init(void);
 static void _curl_cleanup(void);
 
-static enum event_loop_init_error _epoll_init(void);
-static void _epoll_cleanup(void);
+static enum event_loop_init_error _fd_table_init(void);
+static void _fd_table_cleanup(void);
+// Returns the earliest of the event queue's head and CURL's timeout. UINT64_MAX
+// means there is nothing to wait for.
+static uint64_t _timer_deadline_get(void);
+static enum event_loop_init_error _wake_init(void);
+static void _wake_cleanup(void);
+static void _wake_drain(void);
+/* I/O backend. EVENT_LOOP_BACKEND picks one at compile time like
+ * EVENT_QUEUE_BACKEND does for the event queue. A backend watches wake_fd and the
+ * fds in the fd table, and implements _event_loop_poll. Events are epoll bits for
+ * both.
+ */
+// Sets up the backend. wake_fd has to exist already.
+static enum event_loop_init_error _backend_init(void);
+static void _backend_cleanup(void);
+/* Registers fd for events or changes what it's registered for. registered says
+ * which. @returns 0 or the errno of the failure.
+ */
+static int _backend_fd_set(int fd, uint32_t events, int registered);
+static int _backend_fd_del(int fd, int registered);
+// Has the backend report fd again if it's still ready.
+static void _backend_fd_rearm(int fd);
+#if EVENT_LOOP_BACKEND == EVENT_LOOP_BACKEND_IO_URING
+// Queues a multishot poll for fd under its next generation.
+static int _uring_poll_arm(int fd, uint32_t events);
+// Queues the removal of fd's current poll.
+static int _uring_poll_cancel(int fd);
+static int _uring_wake_arm(void);
+static void _uring_completion_handle(const struct io_uring_cqe *cqe);
+#else
+static enum event_loop_init_error _timer_init(void);
+static void _timer_cleanup(void);
+// Arms the timerfd for the earliest deadline. Does nothing if that didn't change.
+static void _timer_arm(void);
+static void _timer_drain(void);
+// Grows epoll_wait_events to fit every registered fd plus the timerfd and eventfd.
+// Keeps the old array if the allocation fails.
+static void _epoll_wait_events_fit(void);
+#endif
+// Moves every event posted by other threads into the event queue.
+static void _event_inject_drain(void);
+/* Blocks until a socket is ready or the earliest deadline passes. Ready CURL
+ * sockets are handed to curl_multi_socket_action before returning.
+ */
+static void _event_loop_poll(void);
+/* Hands a ready CURL socket to CURL. With an edge triggered backend, keeps doing so
+ * while the kernel still has bytes for it since it won't be reported again until
+ * more arrive.
+ */
+static void _curl_socket_service(int fd, uint32_t epoll_events);
+static int _epoll_events_to_curl_select(uint32_t epoll_events);
 static uint32_t _event_loop_action_flags_to_epoll_events(uint32_t action_flags);
 
-static void _epoll_fd_arr_del(int fd);
-static void _epoll_fd_arr_add(int fd);
-static int _epoll_fd_arr_has(int fd);
-
 enum event_loop_init_error event_loop_init(void)
 {
 	enum event_loop_init_error queue_init_result = _queue_init();
 	if (EVENT_LOOP_INIT_ERROR_OK != queue_init_result) {
 		return queue_init_result;
 	}
-	enum event_loop_init_error epoll_init_res = _epoll_init();
-	if (EVENT_LOOP_INIT_ERROR_OK != epoll_init_res) {
-		return epoll_init_res;
+	enum event_loop_init_error fd_table_init_res = _fd_table_init();
+	if (EVENT_LOOP_INIT_ERROR_OK != fd_table_init_res) {
+		return fd_table_init_res;
+	}
+	enum event_loop_init_error wake_init_res = _wake_init();
+	if (EVENT_LOOP_INIT_ERROR_OK != wake_init_res) {
+		return wake_init_res;
+	}
+	enum event_loop_init_error backend_init_res = _backend_init();
+	if (EVENT_LOOP_INIT_ERROR_OK != backend_init_res) {
+		return backend_init_res;
 	}
 	// Initializing curl depends on the previous two. This is because we set some options
 	// in CURL that require user data pointers.
-	enum event_loop_init_error curl_init_result =
-		_curl_init(event_io_inflight);
+	enum event_loop_init_error curl_init_result = _curl_init();
 	if (EVENT_LOOP_INIT_ERROR_OK != curl_init_result) {
 		return curl_init_result;
 	}
@@ -86,31 +460,106 @@ enum event_loop_init_error event_loop_init(void)
 	return EVENT_LOOP_INIT_ERROR_OK;
 }
 
-void event_loop_start(struct event_loop_context *context);
+void event_loop_start(struct event_loop_context *context)
+{
+	if (NULL == context || NULL == context->portfolio) {
+		printf("event_loop_start was called without a portfolio.\n");
+		return;
+	}
+	loop_context = context;
+	_connections_prewarm();
+	while (1) {
+		_event_inject_drain();
+		_event_loop_dispatch_due();
+		// Check for finished transfers after polling too. They schedule the
+		// follow up events that keep the loop alive.
+		_curl_transfers_check();
+		if (!_event_loop_has_work()) {
+			break;
+		}
+		_event_loop_poll();
+	}
+}
+
+enum event_loop_post_error event_loop_post(const struct event *event)
+{
+	if (NULL == event) {
+		return EVENT_LOOP_POST_ERROR_NULL_EVENT;
+	}
+	if (wake_fd < 0) {
+		return EVENT_LOOP_POST_ERROR_NOT_INITIALIZED;
+	}
+	if (event_ring_push(&event_inject_ring, event)) {
+		return EVENT_LOOP_POST_ERROR_RING_FULL;
+	}
+	// Only the first post since the last drain needs to wake the loop. write is
+	// async signal safe so this works from signal handlers too.
+	if (0 == atomic_exchange(&wake_pending, 1)) {
+		const uint64_t one = 1;
+		(void)write(wake_fd, &one, sizeof(one));
+	}
+	return EVENT_LOOP_POST_ERROR_OK;
+}
 
-enum event_loop_fd_addmod_error
-event_loop_fd_addmod(int fd, uint32_t actions_flag, struct event_io_curl *event)
+enum event_loop_schedule_error event_loop_schedule(const struct event *event)
 {
-	struct epoll_event epoll_ev = {
-		.data = { .ptr = (void *)event },
-		.events = _event_loop_action_flags_to_epoll_events(actions_flag)
-	};
-	const int already_listening = _epoll_fd_arr_has(fd);
-	const int epoll_ctl_op = already_listening ? EPOLL_CTL_MOD :
-						     EPOLL_CTL_ADD;
-	const int epoll_ctl_addmod_result =
-		epoll_ctl(epoll_fd, epoll_ctl_op, fd, &epoll_ev);
-	if (0 == epoll_ctl_addmod_result) {
+	if (NULL == event) {
+		return EVENT_LOOP_SCHEDULE_ERROR_NULL_EVENT;
+	}
+	// Coalesce with the pending event for the same target. This saves a node and
+	// keeps us from doing the same fetch or redraw twice.
+	struct event_node *pending = event_queue_pending_get(
+		&event_queue, event->tag, event_target_get(event));
+	if (NULL != pending) {
+		_event_coalesce(pending, event);
+		return EVENT_LOOP_SCHEDULE_ERROR_COALESCED;
+	}
+	struct static_mem_cache_malloc_result node_result =
+		static_mem_cache_malloc(&event_node_cache);
+	if (STATIC_MEM_CACHE_MALLOC_ERROR_OK != node_result.error ||
+	    NULL == node_result.ptr) {
+		return EVENT_LOOP_SCHEDULE_ERROR_EVENT_CACHE_OOM;
+	}
+	struct event_node *node = (struct event_node *)node_result.ptr;
+	node->requeue_next = NULL;
+	node->event = *event;
+	if (event_queue_add(&event_queue, node)) {
+		(void)static_mem_cache_free(&event_node_cache, node);
+		return EVENT_LOOP_SCHEDULE_ERROR_EVENT_CACHE_OOM;
+	}
+	return EVENT_LOOP_SCHEDULE_ERROR_OK;
+}
+
+enum event_loop_fd_addmod_error event_loop_fd_addmod(int fd,
+						     uint32_t actions_flag)
+{
+	if (fd < 0 || (size_t)fd >= poll_fd_masks_len) {
+		printf("event_loop_fd_addmod got fd %d which is outside the fd table.\n",
+		       fd);
+		return EVENT_LOOP_FD_ADDMOD_ERROR_INVALID_FD;
+	}
+	const uint32_t events =
+		_event_loop_action_flags_to_epoll_events(actions_flag);
+	const uint8_t mask = (uint8_t)(POLL_FD_REGISTERED | events);
+#if !POLL_EDGE_TRIGGERED
+	// An edge triggered backend always hears about it. Rearming the fd is what
+	// gets a socket that's already writable reported when CURL asks for
+	// POLL_OUT again.
+	if (mask == poll_fd_masks[fd]) {
+		// Nothing the backend knows about would change.
+		return EVENT_LOOP_FD_ADDMOD_ERROR_OK;
+	}
+#endif
+	const int already_listening = 0 != poll_fd_masks[fd];
+	const int set_errno = _backend_fd_set(fd, events, already_listening);
+	if (0 == set_errno) {
+		poll_fd_masks[fd] = mask;
 		if (!already_listening) {
-			_epoll_fd_arr_add(fd);
+			++poll_fds_registered;
 		}
 		return EVENT_LOOP_FD_ADDMOD_ERROR_OK;
 	}
-	const char *epoll_ctl_op_str = already_listening ? "EPOLL_CTL_MOD" :
-							   "EPOLL_CTL_ADD";
-	printf("epoll_ctl (%s) failed with errno %d\n", epoll_ctl_op_str,
-	       errno);
-	switch (errno) {
+	switch (set_errno) {
 	case ENOENT:
 		printf("event_loop_fd_addmod attempted to modify a fd not registered with epoll.\n");
 		return EVENT_LOOP_FD_ADDMOD_ERROR_INVALID_FD;
@@ -133,23 +582,28 @@ unrecoverable:
 
 enum event_loop_fd_del_error event_loop_fd_del(int fd)
 {
-	if (epoll_fd < 0) {
+	if (NULL == poll_fd_masks) {
 		printf("event_loop_fd_del was called before the event loop was initialized.");
 		// I could call init here but eh. I don't like hidden behavior like that
 		goto unrecoverable;
 	}
-	// Docs state epoll_ctl ignores the epoll_event arg for op EPOLL_CTL_DEL after
-	// Linux 2.6.9. We will specify it anyway for portability.
-	struct epoll_event epoll_ev;
-	int epoll_del_result =
-		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &epoll_ev);
-	if (0 == epoll_del_result) {
-		_epoll_fd_arr_del(fd);
+	if (fd < 0 || (size_t)fd >= poll_fd_masks_len) {
+		printf("event_loop_fd_del got fd %d which is outside the fd table.\n",
+		       fd);
+		return EVENT_LOOP_FD_DEL_ERROR_INVALID_FD;
+	}
+	// Whatever the backend says, the fd isn't registered after this.
+	const int registered = 0 != poll_fd_masks[fd];
+	if (registered) {
+		--poll_fds_registered;
+	}
+	poll_fd_masks[fd] = 0;
+	const int del_errno = _backend_fd_del(fd, registered);
+	if (0 == del_errno) {
 		return EVENT_LOOP_FD_DEL_ERROR_OK;
 	}
 	// Error occurred, figure out what to do
-	printf("epoll_ctl (EPOLL_CTL_DEL) failed with errno %d\n", errno);
-	switch (errno) {
+	switch (del_errno) {
 	case ENOENT:
 		printf("event_loop_fd_del attempted to delete a fd not registered with epoll.\n");
 		return EVENT_LOOP_FD_DEL_ERROR_INVALID_FD;
@@ -168,171 +622,1954 @@ unrecoverable:
 	exit(1);
 }
 
-static enum event_loop_init_error _queue_init(void)
+static void _event_loop_seed(struct event_loop_context *context)
 {
-	const int event_node_cache_init_res = static_mem_cache_init(
-		&event_node_cache, EVENT_NODE_STATIC_BUFFER,
-		MEM_CACHE_EVENT_NODE_COUNT, sizeof(struct event_node),
-		STATIC_MEM_CACHE_FLAG_CHECK_FREE_LIST_ON_FREE);
-	if (STATIC_MEM_CACHE_INIT_ERROR_OK != event_node_cache_init_res) {
-		printf("Failed to initialize the event static mem cache with result %d\n",
-		       event_node_cache_init_res);
-		return EVENT_LOOP_INIT_ERROR_EVENT_CACHE_FAIL;
+	const uint64_t now_ms = timestamp_ms_get();
+	jitter_state = timestamp_us_get() | 1;
+#if EVENT_QUOTE_STREAM
+	// The stream brings every quote so there's nothing to poll.
+	const struct event connect = {
+		.tag = TECZKA_EVENT_STREAM_CONNECT,
+		.run_timestamp_ms = now_ms,
+		.stream_connect_info = { .portfolio = context->portfolio },
+	};
+	(void)event_loop_schedule(&connect);
+#else
+	struct equity_node *curr;
+	uint64_t equity_count = 0;
+	list_for_each(&context->portfolio->equity_head, curr, struct equity_node,
+		      link) {
+		++equity_count;
 	}
-	const int event_queue_init_res = event_queue_init(&event_queue);
-	if (event_queue_init_res) {
-		printf("Failed to initialize the event queue\n");
-		return EVENT_LOOP_INIT_ERROR_EVENT_QUEUE_FAIL;
+	// Split the portfolio into as few partitions as there are batches and even
+	// out their sizes. Each partition is fetched by one periodic event for its
+	// first equity.
+	const uint64_t partitions_len =
+		(equity_count + QUOTE_BATCH_SYMBOLS_MAX - 1) / QUOTE_BATCH_SYMBOLS_MAX;
+	uint64_t i = 0;
+	list_for_each(&context->portfolio->equity_head, curr, struct equity_node,
+		      link) {
+		const uint64_t partition_index = i++ * partitions_len / equity_count;
+		struct fetch_partition *partition = &fetch_partitions[partition_index];
+		partition->stocks[partition->stocks_len++] = &curr->equity;
+		curr->equity.fetch_partition = partition_index;
 	}
-	return EVENT_LOOP_INIT_ERROR_OK;
+	// Spread the first fetches evenly over one interval. Every fetch keeps its phase
+	// after that so the batches never all hit the network in the same millisecond.
+	for (i = 0; i < partitions_len; ++i) {
+		struct equity *first = fetch_partitions[i].stocks[0];
+		const uint64_t phase_ms =
+			now_ms + i * EVENT_FETCH_STOCK_INTERVAL_MS / partitions_len;
+		const struct event fetch = {
+			.tag = TECZKA_EVENT_FETCH_STOCK,
+			.flags = EVENT_FLAG_PERIODIC,
+			.period_ms = EVENT_FETCH_STOCK_INTERVAL_MS,
+			.run_timestamp_ms = phase_ms,
+			.period_base_ms = phase_ms,
+			.stock_fetch_info = { .stock = first },
+		};
+		const enum event_loop_schedule_error schedule_result =
+			event_loop_schedule(&fetch);
+		if (EVENT_LOOP_SCHEDULE_ERROR_OK != schedule_result) {
+			printf("Failed to schedule the first fetch for %s with result %d\n",
+			       first->key, schedule_result);
+		}
+	}
+#endif
+	const struct event display = {
+		.tag = TECZKA_EVENT_DISPLAY_PORTFOLIO,
+		.run_timestamp_ms = now_ms,
+		.portfolio_display_info = { .portfolio = context->portfolio },
+	};
+	(void)event_loop_schedule(&display);
 }
 
-static enum event_loop_init_error
-_curl_init(struct event_io_curl *event_io_array)
+static void _event_inject_drain(void)
 {
-	CURLcode curl_init_result =
-		curl_global_init(CURL_GLOBAL_SSL | CURL_GLOBAL_ACK_EINTR);
-	if (CURLE_OK != curl_init_result) {
-		printf("curl_global_init failed with code %d\n",
-		       curl_init_result);
-		return EVENT_LOOP_INIT_ERROR_CURL_GLOBAL_FAIL;
+	// Clear the flag before draining. An event posted after this point wakes the
+	// loop again so nothing gets stranded in the ring. The exchange also makes
+	// every event pushed before the flag was set visible to us.
+	(void)atomic_exchange(&wake_pending, 0);
+	struct event event;
+	while (0 == event_ring_pop(&event_inject_ring, &event)) {
+		const enum event_loop_schedule_error schedule_result =
+			event_loop_schedule(&event);
+		switch (schedule_result) {
+		case EVENT_LOOP_SCHEDULE_ERROR_OK:
+		case EVENT_LOOP_SCHEDULE_ERROR_COALESCED:
+			break;
+		case EVENT_LOOP_SCHEDULE_ERROR_NULL_EVENT:
+		case EVENT_LOOP_SCHEDULE_ERROR_EVENT_CACHE_OOM:
+		default:
+			printf("Dropped a posted event with tag %d. Scheduling failed with result %d\n",
+			       event.tag, schedule_result);
+			break;
+		}
 	}
-	curl_multi_handle = curl_multi_init();
-	if (NULL == curl_multi_handle) {
-		printf("curl_multi_init failed\n");
-		return EVENT_LOOP_INIT_ERROR_CURL_MULTI_FAIL;
+}
+
+static void _event_loop_seed_try(void)
+{
+	if (loop_seeded || !portfolio_imported || 0 != prewarm_pending) {
+		return;
 	}
-	socket_callback_context = (struct teczka_curl_socket_callback_context){
-		.multi_handle = curl_multi_handle,
-		.event_io_array = event_io_array,
-	};
-	int setopt_aggregate_result = _curl_socket_setopts();
-	setopt_aggregate_result = setopt_aggregate_result ||
-				  _curl_timer_setopts();
-	if (setopt_aggregate_result) {
-		return EVENT_LOOP_INIT_ERROR_CURL_SETOPT_FAIL;
+	loop_seeded = 1;
+	_event_loop_seed(loop_context);
+}
+
+static int _event_loop_has_work(void)
+{
+	// Until the loop is seeded we're waiting on the import thread's post.
+	return !loop_seeded || NULL != event_queue_peek(&event_queue) ||
+	       NULL != requeue_deferred ||
+	       curl_running_handles > 0 ||
+	       UINT64_MAX != event_queue.curl_timeout_event.run_timestamp_ms;
+}
+
+static void _event_loop_dispatch_due(void)
+{
+	struct event_node *due[EVENT_LOOP_DUE_BATCH_LEN];
+	size_t due_len;
+	do {
+		// One clock read per batch. The groups below keep it up to date.
+		uint64_t now_ms = timestamp_ms_get();
+		if (event_queue.curl_timeout_event.run_timestamp_ms <= now_ms) {
+			_curl_timeout_service();
+		}
+		if (requeue_retry_ms <= now_ms) {
+			_event_requeue_deferred_retry(now_ms);
+		}
+		due_len = event_queue_dequeue_due(&event_queue, now_ms, due,
+						  EVENT_LOOP_DUE_BATCH_LEN);
+		const size_t order_len =
+			sizeof(EVENT_DISPATCH_ORDER) / sizeof(enum event_tag);
+		for (size_t i = 0; i < order_len; ++i) {
+			now_ms = _event_group_run(EVENT_DISPATCH_ORDER[i], due,
+						  due_len, now_ms);
+		}
+		// A full batch means more events may be due.
+	} while (EVENT_LOOP_DUE_BATCH_LEN == due_len);
+}
+
+static uint64_t _event_group_run(enum event_tag tag, struct event_node *due[],
+				 size_t due_len, uint64_t now_ms)
+{
+	size_t group_len = 0;
+	for (size_t i = 0; i < due_len; ++i) {
+		if (NULL != due[i] && tag == due[i]->event.tag) {
+			++group_len;
+		}
+	}
+	if (0 == group_len) {
+		return now_ms;
+	}
+	// If the group's worst case runtime would carry us past CURL's deadline, let
+	// CURL go first. Calling it a little early is harmless, calling it late stalls
+	// every transfer.
+	const uint64_t worst_ms =
+		_event_runtime_estimate_get(tag)->max * group_len / 1000;
+	if (now_ms + worst_ms >= event_queue.curl_timeout_event.run_timestamp_ms) {
+		_curl_timeout_service();
+	}
+	const uint64_t start_us = timestamp_us_get();
+	size_t ran_len = 0;
+	size_t dropped_len = 0;
+	for (size_t i = 0; i < due_len; ++i) {
+		if (NULL == due[i] || tag != due[i]->event.tag) {
+			continue;
+		}
+		if (_event_render_drop(&due[i]->event, now_ms)) {
+			++dropped_len;
+		} else {
+			_event_run(&due[i]->event);
+			++ran_len;
+		}
+		// Handlers can schedule events and reuse this node once it's freed, so
+		// drop it from the batch.
+		if (EVENT_FLAG_PERIODIC & due[i]->event.flags) {
+			_event_periodic_requeue(due[i], now_ms);
+		} else {
+			(void)static_mem_cache_free(&event_node_cache, due[i]);
+		}
+		due[i] = NULL;
+	}
+	const uint64_t end_us = timestamp_us_get();
+	if (ran_len > 0) {
+		_event_runtime_record(tag, (end_us - start_us) / ran_len);
+	}
+	if (dropped_len > 0) {
+		// Make sure the screen catches up once the load passes. This coalesces
+		// with any redraw that's already pending.
+		const struct event portfolio_display = {
+			.tag = TECZKA_EVENT_DISPLAY_PORTFOLIO,
+			.run_timestamp_ms = end_us / 1000 +
+					    EVENT_DISPLAY_PORTFOLIO_DELAY_MS,
+			.portfolio_display_info = { .portfolio =
+							    loop_context->portfolio },
+		};
+		(void)event_loop_schedule(&portfolio_display);
+	}
+	return end_us / 1000;
+}
+
+static int _event_render_drop(const struct event *event, uint64_t now_ms)
+{
+	return EVENT_PRIORITY_RENDER == event_priority_get(event) &&
+	       now_ms > event->run_timestamp_ms + EVENT_RENDER_DROP_LATE_MS;
+}
+
+static void _event_run(const struct event *event)
+{
+	switch (event->tag) {
+	case TECZKA_EVENT_PORTFOLIO_IMPORTED:
+		_event_portfolio_imported_run(event);
+		break;
+	case TECZKA_EVENT_FETCH_STOCK:
+		_event_stock_fetch_run(event);
+		break;
+	case TECZKA_EVENT_FETCH_HEDGE:
+		_event_fetch_hedge_run(event);
+		break;
+	case TECZKA_EVENT_STREAM_CONNECT:
+		_event_stream_connect_run(event);
+		break;
+	case TECZKA_EVENT_DISPLAY_STOCK:
+		_event_stock_display_run(event);
+		break;
+	case TECZKA_EVENT_DISPLAY_PORTFOLIO:
+		_event_portfolio_display_run(event);
+		break;
+	case TECZKA_EVENT_CURL_TIMEOUT:
+	default:
+		// curl_timeout_event lives outside the queue. Seeing it here is a bug.
+		printf("_event_run got an event with unexpected tag %d\n",
+		       event->tag);
+		break;
 	}
+}
 
-	return EVENT_LOOP_INIT_ERROR_OK;
+static void _event_periodic_requeue(struct event_node *node, uint64_t now_ms)
+{
+	struct event *event = &node->event;
+	event->run_timestamp_ms = _event_periodic_next(event, now_ms);
+	const enum event_loop_schedule_error requeue_result =
+		_event_node_requeue(node);
+	if (EVENT_LOOP_SCHEDULE_ERROR_EVENT_CACHE_OOM != requeue_result) {
+		return;
+	}
+	printf("Failed to requeue the event with tag %d with result %d. Retrying in %d ms\n",
+	       event->tag, requeue_result, EVENT_FETCH_STOCK_RETRY_MS);
+	node->requeue_next = requeue_deferred;
+	requeue_deferred = node;
+	if (UINT64_MAX == requeue_retry_ms) {
+		requeue_retry_ms = now_ms + EVENT_FETCH_STOCK_RETRY_MS;
+	}
 }
 
-static int _curl_socket_setopts(void)
+static enum event_loop_schedule_error
+_event_node_requeue(struct event_node *node)
 {
-	CURLMcode socket_funtion_opt_result;
-	CURLMcode socket_data_opt_result;
+	struct event *event = &node->event;
+	// The handler may have scheduled the same work while this node was out of the
+	// queue (a fetch retry does). Merge with it rather than queueing both.
+	struct event_node *pending = event_queue_pending_get(
+		&event_queue, event->tag, event_target_get(event));
+	if (NULL != pending) {
+		_event_coalesce(pending, event);
+		(void)static_mem_cache_free(&event_node_cache, node);
+		return EVENT_LOOP_SCHEDULE_ERROR_COALESCED;
+	}
+	if (event_queue_add(&event_queue, node)) {
+		return EVENT_LOOP_SCHEDULE_ERROR_EVENT_CACHE_OOM;
+	}
+	return EVENT_LOOP_SCHEDULE_ERROR_OK;
+}
 
-	socket_funtion_opt_result =
-		curl_multi_setopt(curl_multi_handle, CURLMOPT_SOCKETFUNCTION,
-				  teczka_curl_socket_callback);
-	if (CURLM_OK != socket_funtion_opt_result) {
-		printf("curl_multi_setopt CURLMOPT_SOCKETFUNCTION failed with curlm code %d\n",
-		       socket_funtion_opt_result);
-		return 1;
+static void _event_requeue_deferred_retry(uint64_t now_ms)
+{
+	requeue_retry_ms = UINT64_MAX;
+	while (NULL != requeue_deferred) {
+		struct event_node *node = requeue_deferred;
+		struct event_node *next = node->requeue_next;
+		node->requeue_next = NULL;
+		if (EVENT_LOOP_SCHEDULE_ERROR_EVENT_CACHE_OOM ==
+		    _event_node_requeue(node)) {
+			node->requeue_next = next;
+			requeue_retry_ms = now_ms + EVENT_FETCH_STOCK_RETRY_MS;
+			return;
+		}
+		requeue_deferred = next;
 	}
-	socket_data_opt_result =
-		curl_multi_setopt(curl_multi_handle, CURLMOPT_SOCKETDATA,
-				  (void *)&socket_callback_context);
-	if (CURLM_OK != socket_data_opt_result) {
-		printf("curl_multi_setopt CURLMOPT_SOCKETDATA failed with curlm code %d\n",
-		       socket_funtion_opt_result);
-		return 1;
+}
+
+static void _event_coalesce(struct event_node *pending,
+			    const struct event *event)
+{
+	if (EVENT_FLAG_PERIODIC & event->flags) {
+		pending->event.flags |= EVENT_FLAG_PERIODIC;
+		pending->event.period_ms = event->period_ms;
+		pending->event.period_base_ms = event->period_base_ms;
+	}
+	if (event->run_timestamp_ms < pending->event.run_timestamp_ms) {
+		(void)event_queue_reschedule(&event_queue, pending,
+					     event->run_timestamp_ms);
 	}
-	return 0;
 }
 
-static int _curl_timer_setopts(void)
+static uint64_t _event_periodic_next(struct event *event, uint64_t now_ms)
 {
-	CURLMcode timer_function_opt_result;
-	CURLMcode timer_data_opt_result;
+	const uint64_t period_ms = event->period_ms > 0 ? event->period_ms : 1;
+	uint64_t next_ms = event->period_base_ms + period_ms;
+	if (next_ms <= now_ms) {
+		// Running every missed period back to back would only make us later.
+		next_ms += ((now_ms - next_ms) / period_ms + 1) * period_ms;
+	}
+	event->period_base_ms = next_ms;
+	return _event_jitter_apply(next_ms, now_ms);
+}
 
-	timer_function_opt_result =
-		curl_multi_setopt(curl_multi_handle, CURLMOPT_TIMERFUNCTION,
-				  teczka_curl_timer_callback);
-	if (CURLM_OK != timer_function_opt_result) {
-		printf("curl_mutli_setopt CURLMOPT_TIMERFUNCTION failed with curlm code %d\n",
-		       timer_function_opt_result);
-		return 1;
+static uint64_t _event_jitter_apply(uint64_t run_timestamp_ms, uint64_t now_ms)
+{
+	if (0 == EVENT_PERIODIC_JITTER_MS) {
+		return run_timestamp_ms;
 	}
+	jitter_state ^= jitter_state << 13;
+	jitter_state ^= jitter_state >> 7;
+	jitter_state ^= jitter_state << 17;
+	// Centered on zero so periodic events don't drift late on average.
+	const uint64_t offset_ms = jitter_state % EVENT_PERIODIC_JITTER_MS;
+	const uint64_t jittered_ms =
+		run_timestamp_ms + offset_ms - EVENT_PERIODIC_JITTER_MS / 2;
+	return jittered_ms < now_ms ? now_ms : jittered_ms;
+}
 
-	timer_data_opt_result = curl_multi_setopt(
-		curl_multi_handle, CURLMOPT_TIMERDATA, (void *)&event_queue);
-	if (CURLM_OK != timer_data_opt_result) {
-		printf("curl_mutli_setopt CURLMOPT_TIMERDATA failed with curlm code %d\n",
-		       timer_data_opt_result);
+static void _event_stock_fetch_run(const struct event *event)
+{
+	struct equity *stock = event->stock_fetch_info.stock;
+	struct event_io_curl *event_io =
+		fetch_inflight < fetch_limit ? _event_io_slot_get() : NULL;
+	if (NULL == event_io && 0 == _fetch_defer(stock)) {
+		return;
+	}
+	if (NULL == event_io) {
+		// Nowhere to wait for the limit. Try again shortly instead of waiting
+		// a whole period. A periodic fetch merges into the retry when it's
+		// requeued.
+		struct event retry = *event;
+		retry.flags &= ~EVENT_FLAG_PERIODIC;
+		retry.run_timestamp_ms =
+			timestamp_ms_get() + EVENT_FETCH_STOCK_RETRY_MS;
+		(void)event_loop_schedule(&retry);
+		return;
+	}
+	_fetch_batch_gather(event_io, stock);
+	if (_event_io_transfer_start(event_io, event,
+				     QUOTE_PROVIDER_URL_PREFIX)) {
+		return;
+	}
+	fetch_hedge_tokens += EVENT_FETCH_HEDGE_BUDGET_PERCENT;
+	if (fetch_hedge_tokens > 100 * EVENT_FETCH_HEDGE_BURST) {
+		fetch_hedge_tokens = 100 * EVENT_FETCH_HEDGE_BURST;
+	}
+	if (UINT64_MAX != fetch_hedge_after_ms) {
+		const struct event hedge = {
+			.tag = TECZKA_EVENT_FETCH_HEDGE,
+			.run_timestamp_ms =
+				event_io->started_ms + fetch_hedge_after_ms,
+			.fetch_hedge_info = { .event_io = event_io },
+		};
+		(void)event_loop_schedule(&hedge);
+	}
+}
+
+static void _event_fetch_hedge_run(const struct event *event)
+{
+	struct event_io_curl *primary = event->fetch_hedge_info.event_io;
+	// The hedge event is cancelled when its transfer finishes but check anyway.
+	if (NULL == primary->easy_handle || NULL != primary->hedge_partner) {
+		return;
+	}
+	// A hedge is extra load. Don't send one when the provider is already
+	// struggling or we're out of budget.
+	if (fetch_hedge_tokens < 100 || fetch_inflight >= fetch_limit) {
+		return;
+	}
+	struct event_io_curl *hedge = _event_io_slot_get();
+	if (NULL == hedge) {
+		return;
+	}
+	(void)memcpy(hedge->stocks, primary->stocks,
+		     primary->stocks_len * sizeof(struct equity *));
+	hedge->stocks_len = primary->stocks_len;
+	hedge->partition = primary->partition;
+	if (_event_io_transfer_start(hedge, &primary->event,
+				     QUOTE_PROVIDER_HEDGE_URL_PREFIX)) {
+		return;
+	}
+	fetch_hedge_tokens -= 100;
+	hedge->hedge = 1;
+	hedge->hedge_partner = primary;
+	primary->hedge_partner = hedge;
+}
+
+static int _event_io_transfer_start(struct event_io_curl *event_io,
+				    const struct event *event,
+				    const char *url_prefix)
+{
+	size_t url_len = strlen(url_prefix);
+	(void)memcpy(event_io->url, url_prefix, url_len);
+	for (size_t i = 0; i < event_io->stocks_len; ++i) {
+		const char *key = event_io->stocks[i]->key;
+		const size_t key_len = strnlen(key, EQUITY_KEY_BYTES_MAX);
+		memcpy(event_io->url + url_len, key, key_len);
+		url_len += key_len;
+		event_io->url[url_len++] = ',';
+	}
+	// Replace the trailing comma.
+	event_io->url[url_len - 1] = '\0';
+	CURL *easy_handle = event_io->easy_handle_pooled;
+	(void)curl_easy_setopt(easy_handle, CURLOPT_URL, event_io->url);
+	_event_io_headers_set(event_io);
+	event_io->response_status = 0;
+	event_io->response_etag[0] = '\0';
+	event_io->response_last_modified[0] = '\0';
+	event_io->easy_handle = easy_handle;
+	event_io->sockfd = -1;
+	event_io->event = *event;
+	event_io->started_ms = timestamp_ms_get();
+	event_io->stocks_quoted = 0;
+	event_io->stocks_cursor = 0;
+	++fetch_inflight;
+	event_io->buffer.buffer_used_bytes = 0;
+	event_io->buffer_overflow = 0;
+	quote_scan_init(&event_io->quote_scan, _quote_record_keep, event_io);
+	CURLMcode add_result =
+		curl_multi_add_handle(curl_multi_handle, easy_handle);
+	if (CURLM_OK != add_result) {
+		printf("curl_multi_add_handle failed with curlm code %d\n",
+		       add_result);
+		_curl_transfer_done(event_io, CURLE_FAILED_INIT);
 		return 1;
 	}
 	return 0;
 }
 
-static void _curl_cleanup(void)
+static void _event_io_headers_set(struct event_io_curl *event_io)
 {
-	if (NULL != curl_multi_handle) {
-		CURLMcode multi_cleanup_result =
-			curl_multi_cleanup(curl_multi_handle);
-		if (CURLM_OK != multi_cleanup_result) {
-			printf("curl_multi_cleanup failed with code %d\n",
-			       multi_cleanup_result);
-		}
+	const struct fetch_partition *partition = event_io->partition;
+	struct curl_slist *headers = curl_request_headers;
+	if ('\0' != partition->last_modified[0]) {
+		(void)snprintf(event_io->if_modified_since,
+			       sizeof(event_io->if_modified_since),
+			       "If-Modified-Since: %s", partition->last_modified);
+		event_io->conditional_headers[1] = (struct curl_slist){
+			.data = event_io->if_modified_since,
+			.next = headers,
+		};
+		headers = &event_io->conditional_headers[1];
 	}
-	curl_global_cleanup();
+	if ('\0' != partition->etag[0]) {
+		(void)snprintf(event_io->if_none_match,
+			       sizeof(event_io->if_none_match),
+			       "If-None-Match: %s", partition->etag);
+		event_io->conditional_headers[0] = (struct curl_slist){
+			.data = event_io->if_none_match,
+			.next = headers,
+		};
+		headers = &event_io->conditional_headers[0];
+	}
+	(void)curl_easy_setopt(event_io->easy_handle_pooled, CURLOPT_HTTPHEADER,
+			       headers);
 }
 
-static enum event_loop_init_error _epoll_init(void)
+static int _event_io_answered(const struct event_io_curl *event_io,
+			      CURLcode result)
 {
-	// Docs state size param has been ignored since Linux 2.6.8. We'll specify
-	// one for portability.
-	epoll_fd = epoll_create(EVENT_LOOP_EPOLL_SIZE);
-	if (epoll_fd < 0) {
-		printf("epoll_create failed with errno %d.\n", errno);
-		return EVENT_LOOP_INIT_ERROR_EPOLL_FAIL;
+	const long status = event_io->response_status;
+	if (CURLE_OK != result) {
+		return 0;
 	}
-	return EVENT_LOOP_INIT_ERROR_OK;
+	return 304 == status || (status >= 200 && status <= 299 &&
+				 0 != event_io->stocks_quoted);
 }
 
-static void _epoll_cleanup(void)
+static void _fetch_batch_gather(struct event_io_curl *event_io,
+				const struct equity *stock)
 {
-	if (epoll_fd >= 0) {
-		int close_result = close(epoll_fd);
-		if (0 != close_result) {
-			printf("close failed to close epoll_fd with errno %d.\n",
-			       errno);
-		}
-	}
+	struct fetch_partition *partition =
+		&fetch_partitions[stock->fetch_partition];
+	(void)memcpy(event_io->stocks, partition->stocks,
+		     partition->stocks_len * sizeof(struct equity *));
+	event_io->stocks_len = partition->stocks_len;
+	event_io->partition = partition;
 }
 
-static uint32_t _event_loop_action_flags_to_epoll_events(uint32_t action_flags)
+static void _event_portfolio_imported_run(const struct event *event)
 {
-	// These are the same right now. I just wanted to wrap this in a function
-	// to remind myself of this behavior
-	return action_flags;
+	(void)event;
+	portfolio_imported = 1;
+	_event_loop_seed_try();
 }
 
-static void _epoll_fd_arr_del(int fd)
+static void _event_stream_connect_run(const struct event *event)
 {
-	for (size_t i = 0; i < EVENT_LOOP_FDS_MAX; ++i) {
-		if (fd == epoll_fd_arr[i]) {
-			epoll_fd_arr[i] = -1;
+	struct portfolio *portfolio = event->stream_connect_info.portfolio;
+	struct event_io_curl *event_io = &quote_stream_io;
+	if (NULL != event_io->easy_handle) {
+		return;
+	}
+	size_t url_len = strlen(QUOTE_STREAM_URL_PREFIX);
+	(void)memcpy(quote_stream_url, QUOTE_STREAM_URL_PREFIX, url_len);
+	struct equity_node *curr;
+	list_for_each(&portfolio->equity_head, curr, struct equity_node, link) {
+		const char *key = curr->equity.key;
+		const size_t key_len = strnlen(key, EQUITY_KEY_BYTES_MAX);
+		if (url_len + key_len + 1 >= QUOTE_STREAM_URL_BYTES_MAX) {
+			printf("Too many tickers to stream. Streaming up to %s\n",
+			       key);
 			break;
 		}
+		memcpy(quote_stream_url + url_len, key, key_len);
+		url_len += key_len;
+		quote_stream_url[url_len++] = ',';
+	}
+	// Replace the trailing comma. An empty portfolio keeps the whole prefix.
+	if (url_len > strlen(QUOTE_STREAM_URL_PREFIX)) {
+		--url_len;
+	}
+	quote_stream_url[url_len] = '\0';
+	CURL *easy_handle = event_io->easy_handle_pooled;
+	(void)curl_easy_setopt(easy_handle, CURLOPT_URL, quote_stream_url);
+	event_io->easy_handle = easy_handle;
+	event_io->sockfd = -1;
+	event_io->event = *event;
+	event_io->started_ms = timestamp_ms_get();
+	quote_scan_init(&event_io->quote_scan, _quote_stream_record_apply,
+			portfolio);
+	sse_scan_init(&event_io->sse_scan, &event_io->quote_scan);
+	CURLMcode add_result =
+		curl_multi_add_handle(curl_multi_handle, easy_handle);
+	if (CURLM_OK != add_result) {
+		printf("curl_multi_add_handle failed for the quote stream with curlm code %d\n",
+		       add_result);
+		_quote_stream_done(CURLE_FAILED_INIT);
 	}
 }
 
-static void _epoll_fd_arr_add(int fd)
+static void _quote_stream_done(CURLcode result)
 {
-	for (size_t i = 0; i < EVENT_LOOP_FDS_MAX; ++i) {
-		if (-1 == epoll_fd_arr[i]) {
-			epoll_fd_arr[i] = fd;
-			break;
+	struct event_io_curl *event_io = &quote_stream_io;
+	long status = 0;
+	(void)curl_easy_getinfo(event_io->easy_handle_pooled,
+				CURLINFO_RESPONSE_CODE, &status);
+	printf("Quote stream ended after %" PRIu64
+	       " ms (HTTP %ld): %s. Reconnecting in %d ms\n",
+	       timestamp_ms_get() - event_io->started_ms, status,
+	       curl_easy_strerror(result), EVENT_QUOTE_STREAM_RETRY_MS);
+	(void)curl_multi_remove_handle(curl_multi_handle,
+				       event_io->easy_handle_pooled);
+	event_io->easy_handle = NULL;
+	event_io->sockfd = -1;
+	struct event reconnect = event_io->event;
+	reconnect.run_timestamp_ms =
+		timestamp_ms_get() + EVENT_QUOTE_STREAM_RETRY_MS;
+	(void)event_loop_schedule(&reconnect);
+}
+
+static void _connections_prewarm(void)
+{
+	for (size_t i = 0; i < PREWARM_LEN; ++i) {
+		struct event_io_curl *event_io = &prewarm_io[i];
+		event_io->easy_handle = event_io->easy_handle_pooled;
+		event_io->sockfd = -1;
+		event_io->started_ms = timestamp_ms_get();
+		CURLMcode add_result = curl_multi_add_handle(
+			curl_multi_handle, event_io->easy_handle);
+		if (CURLM_OK != add_result) {
+			printf("curl_multi_add_handle failed for a prewarm with curlm code %d\n",
+			       add_result);
+			event_io->easy_handle = NULL;
+			continue;
 		}
+		++prewarm_pending;
 	}
 }
 
-static int _epoll_fd_arr_has(int fd)
+static int _event_io_prewarm_is(const struct event_io_curl *event_io)
 {
-	for (size_t i = 0; i < EVENT_LOOP_FDS_MAX; ++i) {
-		if (fd == epoll_fd_arr[i]) {
+	for (size_t i = 0; i < PREWARM_LEN; ++i) {
+		if (&prewarm_io[i] == event_io) {
 			return 1;
 		}
 	}
 	return 0;
 }
+
+static void _connection_prewarm_done(struct event_io_curl *event_io,
+				     CURLcode result)
+{
+	// The status doesn't matter. Any answer means the connection is up.
+	if (CURLE_OK != result) {
+		printf("Prewarming a connection failed after %" PRIu64
+		       " ms: %s\n",
+		       timestamp_ms_get() - event_io->started_ms,
+		       curl_easy_strerror(result));
+	}
+	(void)curl_multi_remove_handle(curl_multi_handle,
+				       event_io->easy_handle);
+	event_io->easy_handle = NULL;
+	event_io->sockfd = -1;
+	--prewarm_pending;
+	_event_loop_seed_try();
+}
+
+static void _event_stock_display_run(const struct event *event)
+{
+	const struct equity *stock = event->stock_display_info.stock;
+	char price[CENTS_STRING_BYTES];
+	char change[CENTS_STRING_BYTES];
+	_cents_format(price, stock->valuation.price_cents_current, "");
+	_cents_format(change, stock->valuation.daily_change_absolute_cents,
+		      "+");
+	printf("%-*s %s (%s)\n", EQUITY_KEY_BYTES_MAX, stock->key, price,
+	       change);
+}
+
+static void _event_portfolio_display_run(const struct event *event)
+{
+	struct portfolio *portfolio = event->portfolio_display_info.portfolio;
+	(void)portfolio_update_values(portfolio);
+	char value[CENTS_STRING_BYTES];
+	char daily[CENTS_STRING_BYTES];
+	char lifetime[CENTS_STRING_BYTES];
+	_cents_format(value, portfolio->market_value_cents, "");
+	_cents_format(daily, portfolio->delta_daily_absolute_cents, "+");
+	_cents_format(lifetime, portfolio->delta_lifetime_absolute_cents, "+");
+	printf("Portfolio %s day %s total %s\n", value, daily, lifetime);
+}
+
+static void _cents_format(char buf[CENTS_STRING_BYTES], int64_t cents,
+			  const char *positive_sign)
+{
+	const int64_t abs_cents = cents < 0 ? -cents : cents;
+	(void)snprintf(buf, CENTS_STRING_BYTES, "%s%" PRId64 ".%02" PRId64,
+		       cents < 0 ? "-" : positive_sign, abs_cents / 100,
+		       abs_cents % 100);
+}
+
+static struct event_runtime_estimate_us *
+_event_runtime_estimate_get(enum event_tag tag)
+{
+	// curl_timeout never goes through the dispatcher. Give it something valid.
+	static struct event_runtime_estimate_us unused = { 0 };
+	switch (tag) {
+	case TECZKA_EVENT_PORTFOLIO_IMPORTED:
+		return &runtimes.portfolio_imported;
+	case TECZKA_EVENT_FETCH_STOCK:
+		return &runtimes.stock_fetch;
+	case TECZKA_EVENT_FETCH_HEDGE:
+		return &runtimes.fetch_hedge;
+	case TECZKA_EVENT_STREAM_CONNECT:
+		return &runtimes.stream_connect;
+	case TECZKA_EVENT_DISPLAY_STOCK:
+		return &runtimes.stock_display;
+	case TECZKA_EVENT_DISPLAY_PORTFOLIO:
+		return &runtimes.portfolio_display;
+	case TECZKA_EVENT_CURL_TIMEOUT:
+	default:
+		return &unused;
+	}
+}
+
+static void _event_runtime_record(enum event_tag tag, uint64_t runtime_us)
+{
+	struct event_runtime_estimate_us *estimate =
+		_event_runtime_estimate_get(tag);
+	// EWMA with alpha = 1/8. Signed so it can move down.
+	const int64_t ewma_delta = (int64_t)runtime_us - (int64_t)estimate->ewma;
+	estimate->ewma = (uint64_t)((int64_t)estimate->ewma + ewma_delta / 8);
+	if (runtime_us >= estimate->max) {
+		estimate->max = runtime_us;
+	} else if (estimate->max > estimate->ewma) {
+		estimate->max -= (estimate->max - estimate->ewma) / 64;
+	}
+}
+
+static void _curl_timeout_service(void)
+{
+	event_queue.curl_timeout_event.run_timestamp_ms = UINT64_MAX;
+	CURLMcode action_result =
+		curl_multi_socket_action(curl_multi_handle, CURL_SOCKET_TIMEOUT,
+					 0, &curl_running_handles);
+	if (CURLM_OK != action_result) {
+		printf("curl_multi_socket_action (timeout) failed with curlm code %d\n",
+		       action_result);
+	}
+}
+
+static void _curl_transfers_check(void)
+{
+	int msgs_left = 0;
+	CURLMsg *msg;
+	while (NULL !=
+	       (msg = curl_multi_info_read(curl_multi_handle, &msgs_left))) {
+		if (CURLMSG_DONE != msg->msg) {
+			continue;
+		}
+		char *event_io_ptr = NULL;
+		(void)curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+					&event_io_ptr);
+		struct event_io_curl *event_io =
+			(struct event_io_curl *)event_io_ptr;
+		if (NULL == event_io) {
+			printf("CURL finished a transfer we don't know about.\n");
+			continue;
+		}
+		if (msg->easy_handle != event_io->easy_handle) {
+			// Its hedge partner already won and released it.
+			continue;
+		}
+		if (&quote_stream_io == event_io) {
+			_quote_stream_done(msg->data.result);
+			continue;
+		}
+		if (_event_io_prewarm_is(event_io)) {
+			_connection_prewarm_done(event_io, msg->data.result);
+			continue;
+		}
+		(void)curl_easy_getinfo(event_io->easy_handle,
+					CURLINFO_RESPONSE_CODE,
+					&event_io->response_status);
+		_fetch_limit_update(event_io, msg->data.result);
+		struct event_io_curl *partner = event_io->hedge_partner;
+		if (NULL != partner &&
+		    !_event_io_answered(event_io, msg->data.result)) {
+			// This one failed or had nothing to show for it. Its quotes
+			// are dropped with it and the other finishes the job.
+			_event_io_transfer_release(event_io);
+			continue;
+		}
+		if (NULL != partner) {
+			// First one to finish with an answer wins. Quotes are only
+			// applied in _curl_transfer_done so the loser's, even the ones
+			// it already scanned, never reach the equities.
+			_event_io_transfer_release(partner);
+		}
+		_curl_transfer_done(event_io, msg->data.result);
+	}
+	_fetch_deferred_start();
+}
+
+static void _fetch_limit_update(const struct event_io_curl *event_io,
+				CURLcode result)
+{
+	const long status = event_io->response_status;
+	curl_off_t total_us = 0;
+	(void)curl_easy_getinfo(event_io->easy_handle, CURLINFO_TOTAL_TIME_T,
+				&total_us);
+	// A response too big for the buffer is our problem, not the provider's.
+	const int failed = CURLE_OK != result && !event_io->buffer_overflow;
+	const int throttled = 429 == status || 503 == status;
+	if (!failed && !throttled && _event_io_answered(event_io, result)) {
+		_fetch_latency_record(total_us);
+	}
+	if (failed || throttled) {
+		if (event_io->started_ms < fetch_limit_cut_ms) {
+			return;
+		}
+		fetch_limit /= 2;
+		if (fetch_limit < EVENT_FETCH_INFLIGHT_MIN) {
+			fetch_limit = EVENT_FETCH_INFLIGHT_MIN;
+		}
+		fetch_limit_credit = 0;
+		fetch_limit_cut_ms = timestamp_ms_get();
+		printf("Quote provider is struggling (HTTP %ld). Fetching at most %" PRIu32
+		       " at once.\n",
+		       status, fetch_limit);
+		return;
+	}
+	// Only raise the limit when it's what is holding fetches back. Otherwise
+	// a quiet stretch would ratchet it up to the max without testing it.
+	const int limited = fetch_inflight >= fetch_limit ||
+			    0 != fetch_deferred_len;
+	const curl_off_t target_us =
+		(curl_off_t)EVENT_FETCH_LATENCY_TARGET_MS * 1000;
+	if (!limited || total_us > target_us) {
+		return;
+	}
+	if (++fetch_limit_credit >= fetch_limit) {
+		fetch_limit_credit = 0;
+		if (fetch_limit < EVENT_IO_CURL_SLOTS_MAX) {
+			++fetch_limit;
+		}
+	}
+}
+
+static int _fetch_defer(struct equity *stock)
+{
+	for (size_t i = 0; i < fetch_deferred_len; ++i) {
+		const size_t index = (fetch_deferred_head + i) %
+				     MEM_CACHE_EQUITY_NODE_COUNT;
+		if (stock == fetch_deferred[index]) {
+			return 0;
+		}
+	}
+	if (MEM_CACHE_EQUITY_NODE_COUNT == fetch_deferred_len) {
+		return 1;
+	}
+	const size_t tail = (fetch_deferred_head + fetch_deferred_len) %
+			    MEM_CACHE_EQUITY_NODE_COUNT;
+	fetch_deferred[tail] = stock;
+	++fetch_deferred_len;
+	return 0;
+}
+
+static void _fetch_deferred_start(void)
+{
+	while (0 != fetch_deferred_len && fetch_inflight < fetch_limit) {
+		struct equity *stock = fetch_deferred[fetch_deferred_head];
+		fetch_deferred_head =
+			(fetch_deferred_head + 1) % MEM_CACHE_EQUITY_NODE_COUNT;
+		--fetch_deferred_len;
+		const struct event fetch = {
+			.tag = TECZKA_EVENT_FETCH_STOCK,
+			.run_timestamp_ms = timestamp_ms_get(),
+			.stock_fetch_info = { .stock = stock },
+		};
+		const uint32_t inflight_before = fetch_inflight;
+		_event_stock_fetch_run(&fetch);
+		if (fetch_inflight == inflight_before) {
+			// No slot for it either. It went back in the FIFO (or got
+			// a retry) and there's no point trying the rest.
+			break;
+		}
+	}
+}
+
+static void _curl_transfer_done(struct event_io_curl *event_io, CURLcode result)
+{
+	const uint64_t now_ms = timestamp_ms_get();
+	// The batch is named by its first stock in logs.
+	const char *key = event_io->stocks[0]->key;
+	const size_t others_len = event_io->stocks_len - 1;
+	const long status = event_io->response_status;
+	if (CURLE_OK == result && 304 == status) {
+		// None of the batch's quotes changed so there's nothing to parse,
+		// recompute or redraw.
+	} else if (CURLE_OK == result && (status < 200 || status > 299 ||
+					  0 == event_io->stocks_quoted)) {
+		// An error page that looks like quotes isn't applied either.
+		const struct data_buffer *body = &event_io->buffer;
+		const int log_bytes = body->buffer_used_bytes < RESPONSE_LOG_BYTES_MAX ?
+					      (int)body->buffer_used_bytes :
+					      RESPONSE_LOG_BYTES_MAX;
+		printf("Response for %s (+%zu more) had no quotes (HTTP %ld): %.*s\n",
+		       key, others_len, status, log_bytes, body->buffer);
+	} else if (CURLE_OK == result) {
+		// Keep the validators for the next time the partition is fetched.
+		struct fetch_partition *partition = event_io->partition;
+		(void)memcpy(partition->etag, event_io->response_etag,
+			     sizeof(partition->etag));
+		(void)memcpy(partition->last_modified,
+			     event_io->response_last_modified,
+			     sizeof(partition->last_modified));
+		for (size_t i = 0; i < event_io->stocks_len; ++i) {
+			struct equity *stock = event_io->stocks[i];
+			if (!(event_io->stocks_quoted & ((uint64_t)1 << i))) {
+				printf("Response had no quote for %s\n",
+				       stock->key);
+				continue;
+			}
+			_equity_quote_apply(stock, &event_io->records[i]);
+			const struct event stock_display = {
+				.tag = TECZKA_EVENT_DISPLAY_STOCK,
+				.run_timestamp_ms = now_ms,
+				.stock_display_info = { .stock = stock },
+			};
+			(void)event_loop_schedule(&stock_display);
+		}
+		const struct event portfolio_display = {
+			.tag = TECZKA_EVENT_DISPLAY_PORTFOLIO,
+			.run_timestamp_ms =
+				now_ms + EVENT_DISPLAY_PORTFOLIO_DELAY_MS,
+			.portfolio_display_info = { .portfolio =
+							    loop_context->portfolio },
+		};
+		(void)event_loop_schedule(&portfolio_display);
+	} else if (event_io->buffer_overflow) {
+		printf("Fetching %s (+%zu more) failed: response is larger than %d bytes\n",
+		       key, others_len, EVENT_IO_CURL_RESPONSE_BYTES);
+	} else {
+		printf("Fetching %s (+%zu more) failed: %s\n", key, others_len,
+		       curl_easy_strerror(result));
+	}
+	// Fetch events are periodic so the next fetches are already queued.
+	_event_io_transfer_release(event_io);
+}
+
+static void _event_io_transfer_release(struct event_io_curl *event_io)
+{
+	struct event_node *hedge_pending = event_queue_pending_get(
+		&event_queue, TECZKA_EVENT_FETCH_HEDGE, event_io);
+	if (NULL != hedge_pending) {
+		(void)event_queue_remove(&event_queue, hedge_pending);
+		(void)static_mem_cache_free(&event_node_cache, hedge_pending);
+	}
+	if (NULL != event_io->hedge_partner) {
+		event_io->hedge_partner->hedge_partner = NULL;
+		event_io->hedge_partner = NULL;
+	}
+	event_io->hedge = 0;
+	// The easy handle stays with the slot. Removing it from the multi handle
+	// leaves its connection in the multi's cache for the next transfer.
+	(void)curl_multi_remove_handle(curl_multi_handle,
+				       event_io->easy_handle);
+	event_io->easy_handle = NULL;
+	event_io->sockfd = -1;
+	event_io->buffer.buffer_used_bytes = 0;
+	event_io->buffer_overflow = 0;
+	event_io->stocks_len = 0;
+	event_io->stocks_quoted = 0;
+	--fetch_inflight;
+	_event_io_slot_put(event_io);
+}
+
+static int _latency_compare(const void *a, const void *b)
+{
+	const uint32_t lhs = *(const uint32_t *)a;
+	const uint32_t rhs = *(const uint32_t *)b;
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+static void _fetch_latency_record(curl_off_t total_us)
+{
+	fetch_latency_ms[fetch_latency_next] = (uint32_t)(total_us / 1000);
+	fetch_latency_next =
+		(fetch_latency_next + 1) % EVENT_FETCH_LATENCY_SAMPLES;
+	if (fetch_latency_len < EVENT_FETCH_LATENCY_SAMPLES) {
+		++fetch_latency_len;
+	}
+	if (fetch_latency_len < EVENT_FETCH_LATENCY_SAMPLES ||
+	    0 == EVENT_FETCH_HEDGE_BUDGET_PERCENT) {
+		return;
+	}
+	// A few dozen samples sort in no time next to a network round trip.
+	uint32_t sorted[EVENT_FETCH_LATENCY_SAMPLES];
+	(void)memcpy(sorted, fetch_latency_ms, sizeof(sorted));
+	qsort(sorted, EVENT_FETCH_LATENCY_SAMPLES, sizeof(uint32_t),
+	      _latency_compare);
+	const uint64_t percentile_ms =
+		sorted[(EVENT_FETCH_LATENCY_SAMPLES - 1) *
+		       EVENT_FETCH_HEDGE_PERCENTILE / 100];
+	fetch_hedge_after_ms = percentile_ms < EVENT_FETCH_HEDGE_MIN_MS ?
+				       EVENT_FETCH_HEDGE_MIN_MS :
+				       percentile_ms;
+}
+
+static void _quote_record_keep(const struct quote_record *record,
+			       void *event_io_ptr)
+{
+	struct event_io_curl *event_io = (struct event_io_curl *)event_io_ptr;
+	const uint32_t required = QUOTE_FIELD_SYMBOL | QUOTE_FIELD_PRICE;
+	if (required != (record->fields & required)) {
+		return;
+	}
+	// Look where the last record left off first, then everywhere else.
+	size_t i = event_io->stocks_cursor;
+	size_t checked = 0;
+	for (; checked < event_io->stocks_len; ++checked) {
+		if (i >= event_io->stocks_len) {
+			i = 0;
+		}
+		if (0 == strcmp(record->symbol, event_io->stocks[i]->key)) {
+			break;
+		}
+		++i;
+	}
+	if (checked == event_io->stocks_len) {
+		return;
+	}
+	event_io->stocks_cursor = i + 1;
+	event_io->stocks_quoted |= (uint64_t)1 << i;
+	event_io->records[i] = *record;
+}
+
+static void _quote_stream_record_apply(const struct quote_record *record,
+				       void *portfolio_ptr)
+{
+	struct portfolio *portfolio = (struct portfolio *)portfolio_ptr;
+	const uint32_t required = QUOTE_FIELD_SYMBOL | QUOTE_FIELD_PRICE;
+	if (required != (record->fields & required)) {
+		return;
+	}
+	struct portfolio_equity_get_result get_result =
+		portfolio_equity_get(portfolio, record->symbol);
+	if (PORTFOLIO_EQUITY_GET_ERROR_OK != get_result.error) {
+		return;
+	}
+	struct equity *stock = &get_result.equity->equity;
+	_equity_quote_apply(stock, record);
+	// A burst of pushes for the same ticker coalesces into one redraw and every
+	// ticker's into one portfolio redraw.
+	const uint64_t now_ms = timestamp_ms_get();
+	const struct event stock_display = {
+		.tag = TECZKA_EVENT_DISPLAY_STOCK,
+		.run_timestamp_ms = now_ms,
+		.stock_display_info = { .stock = stock },
+	};
+	(void)event_loop_schedule(&stock_display);
+	const struct event portfolio_display = {
+		.tag = TECZKA_EVENT_DISPLAY_PORTFOLIO,
+		.run_timestamp_ms = now_ms + EVENT_DISPLAY_PORTFOLIO_DELAY_MS,
+		.portfolio_display_info = { .portfolio = portfolio },
+	};
+	(void)event_loop_schedule(&portfolio_display);
+}
+
+static void _equity_quote_apply(struct equity *stock,
+				const struct quote_record *record)
+{
+	struct equity_valuation *valuation = &stock->valuation;
+	valuation->price_cents_current = record->price_cents_current;
+	if (QUOTE_FIELD_CLOSE_PREVIOUS & record->fields) {
+		valuation->price_cents_close_previous =
+			record->price_cents_close_previous;
+	}
+	if (QUOTE_FIELD_OPEN & record->fields) {
+		valuation->price_cents_open = record->price_cents_open;
+	}
+	valuation->daily_change_absolute_cents =
+		valuation->price_cents_current -
+		valuation->price_cents_close_previous;
+	valuation->daily_change_basis_points =
+		delta_basis_points(valuation->daily_change_absolute_cents,
+				   valuation->price_cents_close_previous);
+	(void)equity_ownership_deltas_update(&stock->ownership, valuation);
+}
+
+static struct event_io_curl *_event_io_slot_get(void)
+{
+	if (0 == event_io_free_len &&
+	    event_io_chunks_len < EVENT_IO_CHUNKS_MAX) {
+		// calloc so the new slots start out free like the static ones.
+		struct event_io_chunk *chunk = calloc(1, sizeof(*chunk));
+		if (NULL == chunk) {
+			printf("Failed to allocate %zu more transfer slots\n",
+			       (size_t)EVENT_IO_CURL_BUFFER_LEN);
+		} else {
+			(void)_event_io_chunk_add(chunk);
+		}
+	}
+	if (0 == event_io_free_len) {
+		return NULL;
+	}
+	return event_io_free[--event_io_free_len];
+}
+
+static void _event_io_slot_put(struct event_io_curl *event_io)
+{
+	event_io_free[event_io_free_len++] = event_io;
+}
+
+static enum event_loop_init_error
+_event_io_chunk_add(struct event_io_chunk *chunk)
+{
+	event_io_chunks[event_io_chunks_len++] = chunk;
+	// Push in reverse so slot 0 is handed out first.
+	enum event_loop_init_error result = EVENT_LOOP_INIT_ERROR_OK;
+	for (size_t i = EVENT_IO_CURL_BUFFER_LEN; i-- > 0;) {
+		enum event_loop_init_error slot_result = _event_io_slot_init(
+			&chunk->slots[i], chunk->response_arena[i]);
+		if (EVENT_LOOP_INIT_ERROR_OK != slot_result) {
+			result = slot_result;
+			continue;
+		}
+		_event_io_slot_put(&chunk->slots[i]);
+	}
+	return result;
+}
+
+static enum event_loop_init_error _queue_init(void)
+{
+	const int event_node_cache_init_res = static_mem_cache_init(
+		&event_node_cache, EVENT_NODE_STATIC_BUFFER,
+		MEM_CACHE_EVENT_NODE_COUNT, sizeof(struct event_node),
+		EVENT_NODE_ALLOCATED_BITMAP,
+		STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE |
+			STATIC_MEM_CACHE_FLAG_GROWABLE);
+	if (STATIC_MEM_CACHE_INIT_ERROR_OK != event_node_cache_init_res) {
+		printf("Failed to initialize the event static mem cache with result %d\n",
+		       event_node_cache_init_res);
+		return EVENT_LOOP_INIT_ERROR_EVENT_CACHE_FAIL;
+	}
+	const int event_queue_init_res = event_queue_init(&event_queue);
+	if (event_queue_init_res) {
+		printf("Failed to initialize the event queue\n");
+		return EVENT_LOOP_INIT_ERROR_EVENT_QUEUE_FAIL;
+	}
+	return EVENT_LOOP_INIT_ERROR_OK;
+}
+
+static enum event_loop_init_error _curl_init(void)
+{
+	CURLcode curl_init_result =
+		curl_global_init(CURL_GLOBAL_SSL | CURL_GLOBAL_ACK_EINTR);
+	if (CURLE_OK != curl_init_result) {
+		printf("curl_global_init failed with code %d\n",
+		       curl_init_result);
+		return EVENT_LOOP_INIT_ERROR_CURL_GLOBAL_FAIL;
+	}
+	curl_multi_handle = curl_multi_init();
+	if (NULL == curl_multi_handle) {
+		printf("curl_multi_init failed\n");
+		return EVENT_LOOP_INIT_ERROR_CURL_MULTI_FAIL;
+	}
+	event_queue.curl_timeout_event.curl_timeout_info.multi_handle =
+		curl_multi_handle;
+	socket_callback_context = (struct teczka_curl_socket_callback_context){
+		.multi_handle = curl_multi_handle,
+	};
+	int setopt_aggregate_result = _curl_socket_setopts();
+	setopt_aggregate_result = setopt_aggregate_result ||
+				  _curl_timer_setopts();
+	if (setopt_aggregate_result) {
+		return EVENT_LOOP_INIT_ERROR_CURL_SETOPT_FAIL;
+	}
+	// Keep an idle connection around for every slot so the next poll doesn't
+	// have to handshake again.
+	CURLMcode maxconnects_result =
+		curl_multi_setopt(curl_multi_handle, CURLMOPT_MAXCONNECTS,
+				  (long)EVENT_IO_CURL_BUFFER_LEN);
+	if (CURLM_OK != maxconnects_result) {
+		printf("curl_multi_setopt CURLMOPT_MAXCONNECTS failed with curlm code %d\n",
+		       maxconnects_result);
+		return EVENT_LOOP_INIT_ERROR_CURL_SETOPT_FAIL;
+	}
+#if EVENT_IO_CURL_HTTP2_MULTIPLEX
+	// Let every slot be a stream on the same connection.
+	CURLMcode multiplex_result = curl_multi_setopt(
+		curl_multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	if (CURLM_OK == multiplex_result) {
+		multiplex_result = curl_multi_setopt(
+			curl_multi_handle, CURLMOPT_MAX_CONCURRENT_STREAMS,
+			(long)EVENT_IO_CURL_SLOTS_MAX);
+	}
+	if (CURLM_OK == multiplex_result) {
+		// If the provider only speaks HTTP/1.1 the extra transfers queue
+		// in CURL instead of each opening a connection.
+		multiplex_result = curl_multi_setopt(
+			curl_multi_handle, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+			(long)EVENT_IO_CURL_CONNECTIONS_MAX);
+	}
+	if (CURLM_OK != multiplex_result) {
+		printf("curl_multi_setopt for HTTP/2 multiplexing failed with curlm code %d\n",
+		       multiplex_result);
+		return EVENT_LOOP_INIT_ERROR_CURL_SETOPT_FAIL;
+	}
+#endif
+
+	return _curl_pool_init();
+}
+
+static enum event_loop_init_error _curl_pool_init(void)
+{
+	curl_share_handle = curl_share_init();
+	if (NULL == curl_share_handle) {
+		printf("curl_share_init failed\n");
+		return EVENT_LOOP_INIT_ERROR_CURL_SHARE_FAIL;
+	}
+	// The loop is single threaded so the share handle doesn't need locks.
+	CURLSHcode share_result = curl_share_setopt(
+		curl_share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	if (CURLSHE_OK == share_result) {
+		share_result = curl_share_setopt(curl_share_handle,
+						 CURLSHOPT_SHARE,
+						 CURL_LOCK_DATA_SSL_SESSION);
+	}
+	if (CURLSHE_OK != share_result) {
+		printf("curl_share_setopt failed with curlsh code %d\n",
+		       share_result);
+		return EVENT_LOOP_INIT_ERROR_CURL_SHARE_FAIL;
+	}
+	static const char *const headers[] = QUOTE_PROVIDER_HEADERS;
+	for (size_t i = 0; i < sizeof(headers) / sizeof(char *); ++i) {
+		struct curl_slist *appended =
+			curl_slist_append(curl_request_headers, headers[i]);
+		if (NULL == appended) {
+			printf("curl_slist_append failed\n");
+			return EVENT_LOOP_INIT_ERROR_CURL_EASY_FAIL;
+		}
+		curl_request_headers = appended;
+	}
+#if EVENT_QUOTE_STREAM
+	enum event_loop_init_error stream_result = _quote_stream_init();
+	if (EVENT_LOOP_INIT_ERROR_OK != stream_result) {
+		return stream_result;
+	}
+#endif
+	enum event_loop_init_error prewarm_result = _prewarm_init();
+	if (EVENT_LOOP_INIT_ERROR_OK != prewarm_result) {
+		return prewarm_result;
+	}
+	return _event_io_chunk_add(&event_io_chunk_static);
+}
+
+static enum event_loop_init_error _quote_stream_init(void)
+{
+	enum event_loop_init_error result =
+		_event_io_slot_init(&quote_stream_io, NULL);
+	if (EVENT_LOOP_INIT_ERROR_OK != result) {
+		return result;
+	}
+	quote_stream_io.buffer = (struct data_buffer){ 0 };
+	CURL *easy_handle = quote_stream_io.easy_handle_pooled;
+	CURLcode setopt_result =
+		curl_easy_setopt(easy_handle, CURLOPT_WRITEFUNCTION,
+				 teczka_curl_stream_write_callback);
+	if (CURLE_OK == setopt_result) {
+		// There's no overall timeout on a stream. Give up on it when it goes
+		// quiet instead.
+		setopt_result = curl_easy_setopt(easy_handle,
+						 CURLOPT_LOW_SPEED_LIMIT, 1L);
+	}
+	if (CURLE_OK == setopt_result) {
+		setopt_result =
+			curl_easy_setopt(easy_handle, CURLOPT_LOW_SPEED_TIME,
+					 (long)EVENT_QUOTE_STREAM_IDLE_S);
+	}
+	if (CURLE_OK != setopt_result) {
+		printf("curl_easy_setopt failed for the quote stream with curl code %d\n",
+		       setopt_result);
+		return EVENT_LOOP_INIT_ERROR_CURL_SETOPT_FAIL;
+	}
+	return EVENT_LOOP_INIT_ERROR_OK;
+}
+
+static enum event_loop_init_error _prewarm_init(void)
+{
+	for (size_t i = 0; i < PREWARM_LEN; ++i) {
+		struct event_io_curl *event_io = &prewarm_io[i];
+		enum event_loop_init_error result =
+			_event_io_slot_init(event_io, NULL);
+		if (EVENT_LOOP_INIT_ERROR_OK != result) {
+			return result;
+		}
+		// A HEAD never has a body to write.
+		event_io->buffer = (struct data_buffer){ 0 };
+		CURL *easy_handle = event_io->easy_handle_pooled;
+		CURLcode setopt_result =
+			curl_easy_setopt(easy_handle, CURLOPT_URL, PREWARM_URL);
+		if (CURLE_OK == setopt_result) {
+			setopt_result =
+				curl_easy_setopt(easy_handle, CURLOPT_NOBODY, 1L);
+		}
+		if (CURLE_OK == setopt_result) {
+			setopt_result = curl_easy_setopt(
+				easy_handle, CURLOPT_TIMEOUT_MS,
+				(long)EVENT_PREWARM_TIMEOUT_MS);
+		}
+		if (CURLE_OK != setopt_result) {
+			printf("curl_easy_setopt failed for a prewarm handle with curl code %d\n",
+			       setopt_result);
+			return EVENT_LOOP_INIT_ERROR_CURL_SETOPT_FAIL;
+		}
+	}
+	return EVENT_LOOP_INIT_ERROR_OK;
+}
+
+static enum event_loop_init_error
+_event_io_slot_init(struct event_io_curl *event_io, char *response_region)
+{
+	event_io->buffer = (struct data_buffer){
+		.buffer = response_region,
+		.buffer_size_bytes = EVENT_IO_CURL_RESPONSE_BYTES,
+		.buffer_used_bytes = 0,
+	};
+	CURL *easy_handle = curl_easy_init();
+	if (NULL == easy_handle) {
+		printf("curl_easy_init failed\n");
+		return EVENT_LOOP_INIT_ERROR_CURL_EASY_FAIL;
+	}
+	event_io->easy_handle_pooled = easy_handle;
+	CURLcode setopt_result =
+		curl_easy_setopt(easy_handle, CURLOPT_SHARE, curl_share_handle);
+	if (CURLE_OK == setopt_result) {
+		// Lets CURL's callbacks and messages lead straight back to the slot.
+		setopt_result = curl_easy_setopt(easy_handle, CURLOPT_PRIVATE,
+						 (void *)event_io);
+	}
+	if (CURLE_OK == setopt_result) {
+		setopt_result = curl_easy_setopt(
+			easy_handle, CURLOPT_HTTPHEADER, curl_request_headers);
+	}
+	if (CURLE_OK == setopt_result) {
+		setopt_result = curl_easy_setopt(easy_handle,
+						 CURLOPT_WRITEFUNCTION,
+						 teczka_curl_write_callback);
+	}
+	if (CURLE_OK == setopt_result) {
+		setopt_result = curl_easy_setopt(easy_handle, CURLOPT_WRITEDATA,
+						 (void *)event_io);
+	}
+	if (CURLE_OK == setopt_result) {
+		setopt_result = curl_easy_setopt(easy_handle,
+						 CURLOPT_HEADERFUNCTION,
+						 teczka_curl_header_callback);
+	}
+	if (CURLE_OK == setopt_result) {
+		setopt_result = curl_easy_setopt(easy_handle, CURLOPT_HEADERDATA,
+						 (void *)event_io);
+	}
+	if (CURLE_OK == setopt_result) {
+		// Notice a dead idle connection before we try to reuse it.
+		setopt_result = curl_easy_setopt(easy_handle,
+						 CURLOPT_TCP_KEEPALIVE, 1L);
+	}
+#ifdef QUOTE_PROVIDER_CA_FILE
+	if (CURLE_OK == setopt_result) {
+		setopt_result = curl_easy_setopt(easy_handle, CURLOPT_CAINFO,
+						 QUOTE_PROVIDER_CA_FILE);
+	}
+#endif
+#if EVENT_IO_CURL_HTTP2_MULTIPLEX
+	if (CURLE_OK == setopt_result) {
+		setopt_result = curl_easy_setopt(
+			easy_handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+	}
+	if (CURLE_OK == setopt_result) {
+		// Transfers started while the first connection is still being set
+		// up wait to find out if they can be a stream on it instead of
+		// opening their own.
+		setopt_result =
+			curl_easy_setopt(easy_handle, CURLOPT_PIPEWAIT, 1L);
+	}
+#endif
+	if (CURLE_OK != setopt_result) {
+		printf("curl_easy_setopt failed for a pooled handle with curl code %d\n",
+		       setopt_result);
+		return EVENT_LOOP_INIT_ERROR_CURL_SETOPT_FAIL;
+	}
+	return EVENT_LOOP_INIT_ERROR_OK;
+}
+
+static int _curl_socket_setopts(void)
+{
+	CURLMcode socket_funtion_opt_result;
+	CURLMcode socket_data_opt_result;
+
+	socket_funtion_opt_result =
+		curl_multi_setopt(curl_multi_handle, CURLMOPT_SOCKETFUNCTION,
+				  teczka_curl_socket_callback);
+	if (CURLM_OK != socket_funtion_opt_result) {
+		printf("curl_multi_setopt CURLMOPT_SOCKETFUNCTION failed with curlm code %d\n",
+		       socket_funtion_opt_result);
+		return 1;
+	}
+	socket_data_opt_result =
+		curl_multi_setopt(curl_multi_handle, CURLMOPT_SOCKETDATA,
+				  (void *)&socket_callback_context);
+	if (CURLM_OK != socket_data_opt_result) {
+		printf("curl_multi_setopt CURLMOPT_SOCKETDATA failed with curlm code %d\n",
+		       socket_funtion_opt_result);
+		return 1;
+	}
+	return 0;
+}
+
+static int _curl_timer_setopts(void)
+{
+	CURLMcode timer_function_opt_result;
+	CURLMcode timer_data_opt_result;
+
+	timer_function_opt_result =
+		curl_multi_setopt(curl_multi_handle, CURLMOPT_TIMERFUNCTION,
+				  teczka_curl_timer_callback);
+	if (CURLM_OK != timer_function_opt_result) {
+		printf("curl_mutli_setopt CURLMOPT_TIMERFUNCTION failed with curlm code %d\n",
+		       timer_function_opt_result);
+		return 1;
+	}
+
+	timer_data_opt_result = curl_multi_setopt(
+		curl_multi_handle, CURLMOPT_TIMERDATA, (void *)&event_queue);
+	if (CURLM_OK != timer_data_opt_result) {
+		printf("curl_mutli_setopt CURLMOPT_TIMERDATA failed with curlm code %d\n",
+		       timer_data_opt_result);
+		return 1;
+	}
+	return 0;
+}
+
+static void _curl_cleanup(void)
+{
+	for (size_t c = 0; c < event_io_chunks_len; ++c) {
+		struct event_io_chunk *chunk = event_io_chunks[c];
+		for (size_t i = 0; i < EVENT_IO_CURL_BUFFER_LEN; ++i) {
+			struct event_io_curl *event_io = &chunk->slots[i];
+			if (NULL != event_io->easy_handle) {
+				(void)curl_multi_remove_handle(
+					curl_multi_handle,
+					event_io->easy_handle);
+				event_io->easy_handle = NULL;
+			}
+			if (NULL != event_io->easy_handle_pooled) {
+				curl_easy_cleanup(event_io->easy_handle_pooled);
+				event_io->easy_handle_pooled = NULL;
+			}
+		}
+		if (&event_io_chunk_static != chunk) {
+			free(chunk);
+		}
+	}
+	event_io_chunks_len = 0;
+	event_io_free_len = 0;
+	if (NULL != quote_stream_io.easy_handle) {
+		(void)curl_multi_remove_handle(curl_multi_handle,
+					       quote_stream_io.easy_handle);
+		quote_stream_io.easy_handle = NULL;
+	}
+	if (NULL != quote_stream_io.easy_handle_pooled) {
+		curl_easy_cleanup(quote_stream_io.easy_handle_pooled);
+		quote_stream_io.easy_handle_pooled = NULL;
+	}
+	for (size_t i = 0; i < PREWARM_LEN; ++i) {
+		if (NULL != prewarm_io[i].easy_handle) {
+			(void)curl_multi_remove_handle(curl_multi_handle,
+						       prewarm_io[i].easy_handle);
+			prewarm_io[i].easy_handle = NULL;
+		}
+		if (NULL != prewarm_io[i].easy_handle_pooled) {
+			curl_easy_cleanup(prewarm_io[i].easy_handle_pooled);
+			prewarm_io[i].easy_handle_pooled = NULL;
+		}
+	}
+	if (NULL != curl_share_handle) {
+		(void)curl_share_cleanup(curl_share_handle);
+		curl_share_handle = NULL;
+	}
+	curl_slist_free_all(curl_request_headers);
+	curl_request_headers = NULL;
+	if (NULL != curl_multi_handle) {
+		CURLMcode multi_cleanup_result =
+			curl_multi_cleanup(curl_multi_handle);
+		if (CURLM_OK != multi_cleanup_result) {
+			printf("curl_multi_cleanup failed with code %d\n",
+			       multi_cleanup_result);
+		}
+	}
+	curl_global_cleanup();
+}
+
+static enum event_loop_init_error _fd_table_init(void)
+{
+	// Every fd CURL can open is below the soft limit.
+	struct rlimit nofile;
+	if (0 != getrlimit(RLIMIT_NOFILE, &nofile)) {
+		printf("getrlimit failed with errno %d.\n", errno);
+		return EVENT_LOOP_INIT_ERROR_FD_TABLE_FAIL;
+	}
+	poll_fd_masks_len = EVENT_LOOP_FDS_MAX;
+	if (RLIM_INFINITY != nofile.rlim_cur &&
+	    nofile.rlim_cur < EVENT_LOOP_FDS_MAX) {
+		poll_fd_masks_len = (size_t)nofile.rlim_cur;
+	}
+	// calloc so every fd starts out unregistered.
+	poll_fd_masks = calloc(poll_fd_masks_len, sizeof(uint8_t));
+	if (NULL == poll_fd_masks) {
+		printf("Failed to allocate the fd table for %zu fds.\n",
+		       poll_fd_masks_len);
+		poll_fd_masks_len = 0;
+		return EVENT_LOOP_INIT_ERROR_FD_TABLE_FAIL;
+	}
+	return EVENT_LOOP_INIT_ERROR_OK;
+}
+
+static void _fd_table_cleanup(void)
+{
+	free(poll_fd_masks);
+	poll_fd_masks = NULL;
+	poll_fd_masks_len = 0;
+	poll_fds_registered = 0;
+}
+
+static enum event_loop_init_error _wake_init(void)
+{
+	if (event_ring_init(&event_inject_ring)) {
+		return EVENT_LOOP_INIT_ERROR_EVENTFD_FAIL;
+	}
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd < 0) {
+		printf("eventfd failed with errno %d.\n", errno);
+		return EVENT_LOOP_INIT_ERROR_EVENTFD_FAIL;
+	}
+	return EVENT_LOOP_INIT_ERROR_OK;
+}
+
+static void _wake_cleanup(void)
+{
+	if (wake_fd >= 0) {
+		int close_result = close(wake_fd);
+		if (0 != close_result) {
+			printf("close failed to close wake_fd with errno %d.\n",
+			       errno);
+		}
+		wake_fd = -1;
+	}
+}
+
+static void _wake_drain(void)
+{
+	// Just reset the counter. The ring is drained at the top of every loop
+	// iteration.
+	uint64_t posts;
+	(void)read(wake_fd, &posts, sizeof(posts));
+}
+
+static uint64_t _timer_deadline_get(void)
+{
+	// CURL stores -1 (no timeout) as UINT64_MAX so a plain min works.
+	uint64_t deadline_ms = event_queue.curl_timeout_event.run_timestamp_ms;
+	if (requeue_retry_ms < deadline_ms) {
+		deadline_ms = requeue_retry_ms;
+	}
+	const struct event_node *head = event_queue_peek(&event_queue);
+	if (NULL != head && head->event.run_timestamp_ms < deadline_ms) {
+		deadline_ms = head->event.run_timestamp_ms;
+	}
+	return deadline_ms;
+}
+
+static void _curl_socket_service(int fd, uint32_t epoll_events)
+{
+	const int select_bitmask = _epoll_events_to_curl_select(epoll_events);
+	for (int i = 0; i < EVENT_LOOP_EPOLL_EDGE_DRAIN_MAX; ++i) {
+		CURLMcode action_result = curl_multi_socket_action(
+			curl_multi_handle, fd, select_bitmask,
+			&curl_running_handles);
+		if (CURLM_OK != action_result) {
+			printf("curl_multi_socket_action failed with curlm code %d\n",
+			       action_result);
+		}
+#if POLL_EDGE_TRIGGERED
+		// Bytes CURL already pulled out of the socket but hasn't handled
+		// come back through its timer. Bytes still in the kernel won't
+		// get another edge so they're ours to check for.
+		if (!(EPOLLIN & poll_fd_masks[fd])) {
+			return;
+		}
+		char peeked;
+		if (recv(fd, &peeked, 1, MSG_PEEK) <= 0) {
+			return;
+		}
+#else
+		return;
+#endif
+	}
+	// The socket is busy. Have it reported again so other sockets get a turn.
+	_backend_fd_rearm(fd);
+}
+
+static int _epoll_events_to_curl_select(uint32_t epoll_events)
+{
+	int select_bitmask = 0;
+	if (EPOLLIN & epoll_events) {
+		select_bitmask |= CURL_CSELECT_IN;
+	}
+	if (EPOLLOUT & epoll_events) {
+		select_bitmask |= CURL_CSELECT_OUT;
+	}
+	if ((EPOLLERR | EPOLLHUP) & epoll_events) {
+		select_bitmask |= CURL_CSELECT_ERR;
+	}
+	return select_bitmask;
+}
+
+static uint32_t _event_loop_action_flags_to_epoll_events(uint32_t action_flags)
+{
+	// These are the same right now. I just wanted to wrap this in a function
+	// to remind myself of this behavior
+	return action_flags;
+}
+
+#if EVENT_LOOP_BACKEND == EVENT_LOOP_BACKEND_IO_URING
+
+static enum event_loop_init_error _backend_init(void)
+{
+	const enum uring_init_error init_result =
+		uring_init(&uring, EVENT_LOOP_URING_ENTRIES);
+	switch (init_result) {
+	case URING_INIT_ERROR_OK:
+		break;
+	case URING_INIT_ERROR_UNSUPPORTED:
+		printf("The kernel's io_uring is too old. Build with the epoll backend.\n");
+		return EVENT_LOOP_INIT_ERROR_URING_FAIL;
+	case URING_INIT_ERROR_NULL_RING:
+	case URING_INIT_ERROR_SETUP_FAIL:
+	case URING_INIT_ERROR_MMAP_FAIL:
+	default:
+		printf("uring_init failed with result %d and errno %d.\n",
+		       init_result, errno);
+		return EVENT_LOOP_INIT_ERROR_URING_FAIL;
+	}
+	uring_fd_generations = calloc(poll_fd_masks_len, sizeof(uint32_t));
+	if (NULL == uring_fd_generations) {
+		printf("Failed to allocate io_uring poll generations for %zu fds.\n",
+		       poll_fd_masks_len);
+		return EVENT_LOOP_INIT_ERROR_URING_FAIL;
+	}
+	if (0 != _uring_wake_arm()) {
+		return EVENT_LOOP_INIT_ERROR_EVENTFD_FAIL;
+	}
+	return EVENT_LOOP_INIT_ERROR_OK;
+}
+
+static void _backend_cleanup(void)
+{
+	uring_cleanup(&uring);
+	free(uring_fd_generations);
+	uring_fd_generations = NULL;
+}
+
+static int _backend_fd_set(int fd, uint32_t events, int registered)
+{
+	if (registered) {
+		// Replacing the poll takes two SQEs but they go in with the next wait
+		// either way.
+		const int cancel_errno = _uring_poll_cancel(fd);
+		if (0 != cancel_errno) {
+			return cancel_errno;
+		}
+	}
+	return _uring_poll_arm(fd, events);
+}
+
+static int _backend_fd_del(int fd, int registered)
+{
+	if (!registered) {
+		return ENOENT;
+	}
+	return _uring_poll_cancel(fd);
+}
+
+static void _backend_fd_rearm(int fd)
+{
+	// A new poll reports the fd right away if it's still ready.
+	(void)_backend_fd_set(fd, poll_fd_masks[fd] & ~POLL_FD_REGISTERED, 1);
+}
+
+static void _event_loop_poll(void)
+{
+	const uint64_t deadline_ms = _timer_deadline_get();
+	uint64_t timeout_ns = UINT64_MAX;
+	if (UINT64_MAX != deadline_ms) {
+		const uint64_t now_ms = timestamp_ms_get();
+		// A deadline that already passed still gets a look at what's ready.
+		// 0 would skip waiting for completions altogether.
+		timeout_ns = deadline_ms > now_ms ?
+				     (deadline_ms - now_ms) * 1000000 :
+				     1;
+	}
+	const int enter_errno = uring_submit_and_wait(&uring, timeout_ns);
+	if (0 != enter_errno) {
+		printf("io_uring_enter failed with errno %d. Exitting now\n",
+		       enter_errno);
+		exit(1);
+	}
+	struct io_uring_cqe *cqe;
+	while (NULL != (cqe = uring_cqe_peek(&uring))) {
+		// Handling it can queue SQEs. Let the kernel have the CQE slot back
+		// first.
+		const struct io_uring_cqe completion = *cqe;
+		uring_cqe_seen(&uring);
+		_uring_completion_handle(&completion);
+	}
+}
+
+static int _uring_poll_arm(int fd, uint32_t events)
+{
+	struct io_uring_sqe *sqe = uring_sqe_get(&uring);
+	if (NULL == sqe) {
+		printf("No io_uring SQE for fd %d's poll\n", fd);
+		return EBUSY;
+	}
+	const uint32_t generation = ++uring_fd_generations[fd];
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = events;
+	sqe->user_data = (uint64_t)generation << 32 | (uint32_t)fd;
+	return 0;
+}
+
+static int _uring_poll_cancel(int fd)
+{
+	struct io_uring_sqe *sqe = uring_sqe_get(&uring);
+	if (NULL == sqe) {
+		printf("No io_uring SQE to remove fd %d's poll\n", fd);
+		return EBUSY;
+	}
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)uring_fd_generations[fd] << 32 | (uint32_t)fd;
+	sqe->user_data = URING_USER_DATA_IGNORE;
+	return 0;
+}
+
+static int _uring_wake_arm(void)
+{
+	struct io_uring_sqe *sqe = uring_sqe_get(&uring);
+	if (NULL == sqe) {
+		printf("No io_uring SQE for wake_fd's poll\n");
+		return EBUSY;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = wake_fd;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = EPOLLIN;
+	sqe->user_data = URING_USER_DATA_WAKE;
+	return 0;
+}
+
+static void _uring_completion_handle(const struct io_uring_cqe *cqe)
+{
+	if (URING_USER_DATA_IGNORE == cqe->user_data) {
+		return;
+	}
+	// Without IORING_CQE_F_MORE the multishot poll is over. The kernel ends
+	// one when the completion queue overflows for instance.
+	const int poll_ended = !(IORING_CQE_F_MORE & cqe->flags);
+	if (URING_USER_DATA_WAKE == cqe->user_data) {
+		_wake_drain();
+		if (poll_ended) {
+			(void)_uring_wake_arm();
+		}
+		return;
+	}
+	const int fd = (int)(uint32_t)cqe->user_data;
+	const uint32_t generation = (uint32_t)(cqe->user_data >> 32);
+	if ((size_t)fd >= poll_fd_masks_len || 0 == poll_fd_masks[fd] ||
+	    generation != uring_fd_generations[fd]) {
+		// From a poll that was removed or replaced since.
+		return;
+	}
+	if (cqe->res < 0) {
+		printf("io_uring poll for fd %d failed with errno %d\n", fd,
+		       -cqe->res);
+		return;
+	}
+	if (poll_ended) {
+		(void)_uring_poll_arm(fd, poll_fd_masks[fd] & ~POLL_FD_REGISTERED);
+	}
+	_curl_socket_service(fd, (uint32_t)cqe->res);
+}
+
+#else // EVENT_LOOP_BACKEND == EVENT_LOOP_BACKEND_EPOLL
+
+static enum event_loop_init_error _backend_init(void)
+{
+	// Docs state size param has been ignored since Linux 2.6.8. We'll specify
+	// one for portability.
+	epoll_fd = epoll_create(EVENT_LOOP_EPOLL_SIZE);
+	if (epoll_fd < 0) {
+		printf("epoll_create failed with errno %d.\n", errno);
+		return EVENT_LOOP_INIT_ERROR_EPOLL_FAIL;
+	}
+	epoll_wait_events =
+		calloc(EVENT_LOOP_EPOLL_EVENTS_LEN, sizeof(struct epoll_event));
+	if (NULL == epoll_wait_events) {
+		printf("Failed to allocate the epoll_wait events array.\n");
+		return EVENT_LOOP_INIT_ERROR_EPOLL_FAIL;
+	}
+	epoll_wait_events_len = EVENT_LOOP_EPOLL_EVENTS_LEN;
+	enum event_loop_init_error timer_init_res = _timer_init();
+	if (EVENT_LOOP_INIT_ERROR_OK != timer_init_res) {
+		return timer_init_res;
+	}
+	struct epoll_event epoll_ev = {
+		.data = { .fd = wake_fd },
+		.events = EPOLLIN,
+	};
+	if (0 != epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &epoll_ev)) {
+		printf("epoll_ctl (EPOLL_CTL_ADD) failed for wake_fd with errno %d.\n",
+		       errno);
+		return EVENT_LOOP_INIT_ERROR_EVENTFD_FAIL;
+	}
+	return EVENT_LOOP_INIT_ERROR_OK;
+}
+
+static void _backend_cleanup(void)
+{
+	_timer_cleanup();
+	if (epoll_fd >= 0) {
+		int close_result = close(epoll_fd);
+		if (0 != close_result) {
+			printf("close failed to close epoll_fd with errno %d.\n",
+			       errno);
+		}
+		epoll_fd = -1;
+	}
+	free(epoll_wait_events);
+	epoll_wait_events = NULL;
+	epoll_wait_events_len = 0;
+}
+
+static int _backend_fd_set(int fd, uint32_t events, int registered)
+{
+	// CURL needs the fd for curl_multi_socket_action. The event_io_curl can be
+	// NULL for sockets internal to CURL so it can't identify the socket.
+	struct epoll_event epoll_ev = {
+		.data = { .fd = fd },
+		.events = events,
+	};
+#if EVENT_LOOP_EPOLL_EDGE_TRIGGERED
+	epoll_ev.events |= EPOLLET;
+#endif
+	const int epoll_ctl_op = registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (0 == epoll_ctl(epoll_fd, epoll_ctl_op, fd, &epoll_ev)) {
+		return 0;
+	}
+	const int epoll_ctl_errno = errno;
+	printf("epoll_ctl (%s) failed with errno %d\n",
+	       registered ? "EPOLL_CTL_MOD" : "EPOLL_CTL_ADD", epoll_ctl_errno);
+	return epoll_ctl_errno;
+}
+
+static int _backend_fd_del(int fd, int registered)
+{
+	// Docs state epoll_ctl ignores the epoll_event arg for op EPOLL_CTL_DEL after
+	// Linux 2.6.9. We will specify it anyway for portability.
+	struct epoll_event epoll_ev;
+	if (0 == epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &epoll_ev)) {
+		return 0;
+	}
+	const int epoll_ctl_errno = errno;
+	printf("epoll_ctl (EPOLL_CTL_DEL) failed with errno %d\n",
+	       epoll_ctl_errno);
+	return epoll_ctl_errno;
+}
+
+static void _backend_fd_rearm(int fd)
+{
+	// A MOD has epoll check the fd again even in edge triggered mode.
+	(void)_backend_fd_set(fd, poll_fd_masks[fd] & ~POLL_FD_REGISTERED, 1);
+}
+
+static enum event_loop_init_error _timer_init(void)
+{
+	timer_fd = timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		printf("timerfd_create failed with errno %d.\n", errno);
+		return EVENT_LOOP_INIT_ERROR_TIMERFD_FAIL;
+	}
+	// The timerfd is not a CURL socket so it doesn't go through
+	// event_loop_fd_addmod.
+	struct epoll_event epoll_ev = {
+		.data = { .fd = timer_fd },
+		.events = EPOLLIN,
+	};
+	if (0 != epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &epoll_ev)) {
+		printf("epoll_ctl (EPOLL_CTL_ADD) failed for timer_fd with errno %d.\n",
+		       errno);
+		return EVENT_LOOP_INIT_ERROR_TIMERFD_FAIL;
+	}
+	timer_fd_armed_ms = UINT64_MAX;
+	return EVENT_LOOP_INIT_ERROR_OK;
+}
+
+static void _timer_cleanup(void)
+{
+	if (timer_fd >= 0) {
+		int close_result = close(timer_fd);
+		if (0 != close_result) {
+			printf("close failed to close timer_fd with errno %d.\n",
+			       errno);
+		}
+		timer_fd = -1;
+	}
+}
+
+static void _timer_arm(void)
+{
+	const uint64_t deadline_ms = _timer_deadline_get();
+	if (deadline_ms == timer_fd_armed_ms) {
+		return;
+	}
+	// A zero it_value disarms the timer. That is what we want for UINT64_MAX. A
+	// deadline of 0 is in the past so 1 ns fires just the same.
+	struct itimerspec spec = { 0 };
+	if (UINT64_MAX != deadline_ms) {
+		spec.it_value.tv_sec = (time_t)(deadline_ms / 1000);
+		spec.it_value.tv_nsec = (long)(deadline_ms % 1000) * 1000000;
+		if (0 == deadline_ms) {
+			spec.it_value.tv_nsec = 1;
+		}
+	}
+	if (0 != timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL)) {
+		printf("timerfd_settime failed with errno %d. Exitting now\n",
+		       errno);
+		exit(1);
+	}
+	timer_fd_armed_ms = deadline_ms;
+}
+
+static void _timer_drain(void)
+{
+	uint64_t expirations;
+	// The timerfd is non blocking. EAGAIN just means someone re-armed it after it
+	// fired.
+	(void)read(timer_fd, &expirations, sizeof(expirations));
+	// The timer is one shot so it is disarmed now.
+	timer_fd_armed_ms = UINT64_MAX;
+}
+
+static void _event_loop_poll(void)
+{
+	_timer_arm();
+	_epoll_wait_events_fit();
+	const int ready = epoll_wait(epoll_fd, epoll_wait_events,
+				     (int)epoll_wait_events_len, -1);
+	if (ready < 0) {
+		if (EINTR == errno) {
+			return;
+		}
+		printf("epoll_wait failed with errno %d. Exitting now\n", errno);
+		exit(1);
+	}
+	for (int i = 0; i < ready; ++i) {
+		const int fd = epoll_wait_events[i].data.fd;
+		if (fd == timer_fd) {
+			_timer_drain();
+			continue;
+		}
+		if (fd == wake_fd) {
+			_wake_drain();
+			continue;
+		}
+		_curl_socket_service(fd, epoll_wait_events[i].events);
+	}
+}
+
+static void _epoll_wait_events_fit(void)
+{
+	// The timerfd and eventfd aren't in the fd table.
+	const size_t needed = poll_fds_registered + 2;
+	if (needed <= epoll_wait_events_len) {
+		return;
+	}
+	size_t len = epoll_wait_events_len;
+	while (len < needed) {
+		len *= 2;
+	}
+	struct epoll_event *grown =
+		realloc(epoll_wait_events, len * sizeof(struct epoll_event));
+	if (NULL == grown) {
+		printf("Failed to grow the epoll_wait events array to %zu\n", len);
+		return;
+	}
+	epoll_wait_events = grown;
+	epoll_wait_events_len = len;
+}
+
+#endif // EVENT_LOOP_BACKEND
+
+#undef _POSIX_C_SOURCE
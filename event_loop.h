@@ -17,9 +17,15 @@ struct event_loop_context {
 
 enum event_loop_init_error {
 	EVENT_LOOP_INIT_ERROR_OK = 0,
+	EVENT_LOOP_INIT_ERROR_FD_TABLE_FAIL,
 	EVENT_LOOP_INIT_ERROR_EPOLL_FAIL,
+	EVENT_LOOP_INIT_ERROR_URING_FAIL,
+	EVENT_LOOP_INIT_ERROR_TIMERFD_FAIL,
+	EVENT_LOOP_INIT_ERROR_EVENTFD_FAIL,
 	EVENT_LOOP_INIT_ERROR_CURL_GLOBAL_FAIL,
 	EVENT_LOOP_INIT_ERROR_CURL_MULTI_FAIL,
+	EVENT_LOOP_INIT_ERROR_CURL_SHARE_FAIL,
+	EVENT_LOOP_INIT_ERROR_CURL_EASY_FAIL,
 	EVENT_LOOP_INIT_ERROR_CURL_SETOPT_FAIL,
 	EVENT_LOOP_INIT_ERROR_EVENT_CACHE_FAIL,
 	EVENT_LOOP_INIT_ERROR_EVENT_QUEUE_FAIL,
@@ -35,9 +41,53 @@ enum event_loop_fd_del_error {
 	EVENT_LOOP_FD_DEL_ERROR_INVALID_FD,
 };
 
+enum event_loop_schedule_error {
+	EVENT_LOOP_SCHEDULE_ERROR_OK = 0,
+	EVENT_LOOP_SCHEDULE_ERROR_NULL_EVENT,
+	EVENT_LOOP_SCHEDULE_ERROR_COALESCED,
+	EVENT_LOOP_SCHEDULE_ERROR_EVENT_CACHE_OOM,
+};
+
+enum event_loop_post_error {
+	EVENT_LOOP_POST_ERROR_OK = 0,
+	EVENT_LOOP_POST_ERROR_NULL_EVENT,
+	EVENT_LOOP_POST_ERROR_NOT_INITIALIZED,
+	EVENT_LOOP_POST_ERROR_RING_FULL,
+};
+
 enum event_loop_init_error event_loop_init(void);
+/* Runs the loop until it runs out of work. Connections to the provider are warmed
+ * up right away but nothing is fetched until a TECZKA_EVENT_PORTFOLIO_IMPORTED event
+ * for context->portfolio is posted, so the portfolio can be imported on another
+ * thread in the meantime.
+ */
 void event_loop_start(struct event_loop_context *context);
 
+/* Schedules a copy of event to run at event->run_timestamp_ms. If an event with the
+ * same tag and target (see event_target_get) is already pending, no new event is
+ * queued. The pending one is moved earlier if event should run sooner.
+ * @param event: The event to schedule. The event loop copies it so the caller keeps
+ * ownership.
+ * @returns an enum indicating whether an error occurred
+ * @error EVENT_LOOP_SCHEDULE_ERROR_COALESCED: Not really an error. The event was
+ * merged into the pending one for the same target.
+ * @error EVENT_LOOP_SCHEDULE_ERROR_EVENT_CACHE_OOM: There's no memory left for another
+ * event node or for the event queue's heap to grow.
+ */
+enum event_loop_schedule_error event_loop_schedule(const struct event *event);
+
+/* Posts a copy of event to the event loop from any thread, including signal handlers.
+ * The event goes into a lock-free ring and the loop is woken through an eventfd. The
+ * loop drains the ring into its queue (with event_loop_schedule) at the top of its
+ * next iteration. Everything else in this header must only be called on the loop's
+ * thread.
+ * @param event: The event to post. It is copied so the caller keeps ownership.
+ * @returns an enum indicating whether an error occurred
+ * @error EVENT_LOOP_POST_ERROR_NOT_INITIALIZED: event_loop_init hasn't succeeded yet.
+ * @error EVENT_LOOP_POST_ERROR_RING_FULL: The loop hasn't kept up. Try again later.
+ */
+enum event_loop_post_error event_loop_post(const struct event *event);
+
 /* Adds or modifies information associated with the file descriptor.
  * @param fd: File descriptor to listen to.
  * If you don't specify a flag then that arg is ignored and unchanged.
@@ -45,14 +95,12 @@ void event_loop_start(struct event_loop_context *context);
  * for. The current actions are:
  *   - EVENT_LOOP_FD_POLL_IN: Listen for read operations
  *   - EVENT_LOOP_FD_POLL_OUT: Listen for write operations
- * @param event: The event_io_curl structure associated with that fd. This will be returned
- * by the poll function (epoll only for now) when there is activity. This allows us to
- * identify which event progressed.
+ * The backend (epoll or io_uring) reports the fd itself because curl_multi_socket_action
+ * needs it. Nothing else is tied to the fd since HTTP/2 can share one between transfers.
  * @returns an enum indicating whether an error occurred
  */
-enum event_loop_fd_addmod_error
-event_loop_fd_addmod(int fd, uint32_t actions_flag,
-		     struct event_io_curl *event);
+enum event_loop_fd_addmod_error event_loop_fd_addmod(int fd,
+						     uint32_t actions_flag);
 
 /* Removes the file descriptor from the event loop's listen list.
  * @param fd: File descriptor to listen to.
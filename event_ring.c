@@ -0,0 +1,82 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "event.h"
+#include "event_ring.h"
+
+#define RING_MASK ((size_t)EVENT_RING_CAPACITY - 1)
+
+int event_ring_init(struct event_ring *ring)
+{
+	if (NULL == ring) {
+		return 1;
+	}
+	for (size_t i = 0; i < EVENT_RING_CAPACITY; ++i) {
+		atomic_init(&ring->cells[i].sequence, i);
+	}
+	atomic_init(&ring->tail, 0);
+	ring->head = 0;
+	return 0;
+}
+
+int event_ring_push(struct event_ring *ring, const struct event *event)
+{
+	if (NULL == ring || NULL == event) {
+		return 1;
+	}
+	size_t position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	struct event_ring_cell *cell;
+	while (1) {
+		cell = &ring->cells[position & RING_MASK];
+		const size_t sequence = atomic_load_explicit(
+			&cell->sequence, memory_order_acquire);
+		const intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+		if (0 == diff) {
+			// The cell is free for this position. Try to claim it. On failure
+			// position is reloaded with the current tail.
+			if (atomic_compare_exchange_weak_explicit(
+				    &ring->tail, &position, position + 1,
+				    memory_order_relaxed,
+				    memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			// The consumer hasn't freed this cell from the last lap.
+			return 1;
+		} else {
+			// Another producer claimed this position first.
+			position = atomic_load_explicit(&ring->tail,
+							memory_order_relaxed);
+		}
+	}
+	cell->event = *event;
+	// Publish to the consumer.
+	atomic_store_explicit(&cell->sequence, position + 1,
+			      memory_order_release);
+	return 0;
+}
+
+int event_ring_pop(struct event_ring *ring, struct event *out)
+{
+	if (NULL == ring || NULL == out) {
+		return 1;
+	}
+	const size_t position = ring->head;
+	struct event_ring_cell *cell = &ring->cells[position & RING_MASK];
+	const size_t sequence =
+		atomic_load_explicit(&cell->sequence, memory_order_acquire);
+	if (sequence != position + 1) {
+		// Empty, or a producer claimed the cell but hasn't published it yet.
+		return 1;
+	}
+	*out = cell->event;
+	// Hand the cell to the producer one lap ahead.
+	atomic_store_explicit(&cell->sequence, position + EVENT_RING_CAPACITY,
+			      memory_order_release);
+	ring->head = position + 1;
+	return 0;
+}
+
+#undef RING_MASK
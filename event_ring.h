@@ -0,0 +1,53 @@
+#ifndef _TECZKA_EVENT_RING_H
+#define _TECZKA_EVENT_RING_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "event.h"
+
+_Static_assert((EVENT_RING_CAPACITY & (EVENT_RING_CAPACITY - 1)) == 0,
+	       "EVENT_RING_CAPACITY must be a power of two");
+
+// Keeps the producer and consumer indices on separate cache lines so producers
+// don't bounce the consumer's line around.
+#define EVENT_RING_CACHE_LINE_BYTES (64)
+
+struct event_ring_cell {
+	// Tells producers and the consumer whose turn it is for this cell. A producer
+	// may write it when sequence == position and the consumer may read it when
+	// sequence == position + 1.
+	atomic_size_t sequence;
+	struct event event;
+};
+
+/* event_ring is a bounded lock-free multi-producer/single-consumer queue of events.
+ * Any thread (or a signal handler) can push. Only the event loop thread pops.
+ * Producers claim a position with a CAS on tail and then publish the cell through
+ * its sequence number so the consumer never sees a half written event. No locks
+ * are taken on either side.
+ */
+struct event_ring {
+	struct event_ring_cell cells[EVENT_RING_CAPACITY];
+	alignas(EVENT_RING_CACHE_LINE_BYTES) atomic_size_t tail;
+	// Only the consumer touches head so it doesn't need to be atomic.
+	alignas(EVENT_RING_CACHE_LINE_BYTES) size_t head;
+};
+
+// Initializes the ring to empty. Returns nonzero if ring is NULL.
+int event_ring_init(struct event_ring *ring);
+
+/* Pushes a copy of event onto the ring. Safe to call from any thread and from
+ * signal handlers.
+ * @returns 0 on success and nonzero if ring or event is NULL or the ring is full.
+ */
+int event_ring_push(struct event_ring *ring, const struct event *event);
+
+/* Pops the oldest event off the ring into out. Only one thread may call this.
+ * @returns 0 on success and nonzero if ring or out is NULL or the ring is empty.
+ */
+int event_ring_pop(struct event_ring *ring, struct event *out);
+
+#endif // _TECZKA_EVENT_RING_H
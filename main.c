@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -5,6 +6,7 @@
 #include <curl/multi.h>
 
 #include "config.h"
+#include "event.h"
 #include "event_loop.h"
 #include "portfolio.h"
 #include "portfolio_import.h"
@@ -12,12 +14,19 @@
 
 // Static buffers that will be passed to static mem caches to control
 static struct equity_node EQUITY_NODE_STATIC_BUFFER[MEM_CACHE_EQUITY_NODE_COUNT];
+static uint64_t EQUITY_NODE_ALLOCATED_BITMAP[STATIC_MEM_CACHE_BITMAP_WORDS(
+	MEM_CACHE_EQUITY_NODE_COUNT)];
 
 static struct static_mem_cache equity_node_cache;
 static struct portfolio portfolio;
 
 static char *_fidelity_csv_path_get(int argc, char *argv[]);
 static int _portfolio_init(void);
+/* Imports the CSV at fidelity_csv_path and posts the portfolio to the event loop.
+ * This runs on its own thread so the loop can warm up connections to the provider
+ * while the CSV is read. Nothing else touches the portfolio until it's posted.
+ */
+static void *_portfolio_import_run(void *fidelity_csv_path);
 
 int main(int argc, char *argv[])
 {
@@ -30,20 +39,24 @@ int main(int argc, char *argv[])
 	if (init_globals_result) {
 		return 1;
 	}
-	enum portfolio_import_error portfolio_import_res =
-		portfolio_import_fidelity(&portfolio, &equity_node_cache,
-					  fidelity_csv_path);
-	if (PORTFOLIO_IMPORT_ERROR_OK != portfolio_import_res) {
-		printf("Failed to import the portfolio with result %d\n",
-		       portfolio_import_res);
-		return 1;
-	}
 	enum event_loop_init_error event_loop_init_result = event_loop_init();
 	if (EVENT_LOOP_INIT_ERROR_OK != event_loop_init_result) {
 		printf("Failed to initialize the event loop with result %d\n",
 		       event_loop_init_result);
 		return 1;
 	}
+	pthread_t import_thread;
+	int thread_result = pthread_create(&import_thread, NULL,
+					   _portfolio_import_run,
+					   (void *)fidelity_csv_path);
+	if (thread_result) {
+		printf("Failed to start the portfolio import with error %d\n",
+		       thread_result);
+		return 1;
+	}
+	struct event_loop_context context = { .portfolio = &portfolio };
+	event_loop_start(&context);
+	(void)pthread_join(import_thread, NULL);
 	return 0;
 }
 
@@ -60,7 +73,8 @@ static int _portfolio_init(void)
 	const int equity_node_cache_init_res = static_mem_cache_init(
 		&equity_node_cache, EQUITY_NODE_STATIC_BUFFER,
 		MEM_CACHE_EQUITY_NODE_COUNT, sizeof(struct equity_node),
-		STATIC_MEM_CACHE_FLAG_CHECK_FREE_LIST_ON_FREE);
+		EQUITY_NODE_ALLOCATED_BITMAP,
+		STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE);
 	if (STATIC_MEM_CACHE_INIT_ERROR_OK != equity_node_cache_init_res) {
 		printf("Failed to initialize the equity static mem cache with result %d\n",
 		       equity_node_cache_init_res);
@@ -75,3 +89,29 @@ static int _portfolio_init(void)
 
 	return 0;
 }
+
+static void *_portfolio_import_run(void *fidelity_csv_path)
+{
+	enum portfolio_import_error portfolio_import_res =
+		portfolio_import_fidelity(&portfolio, &equity_node_cache,
+					  fidelity_csv_path);
+	if (PORTFOLIO_IMPORT_ERROR_OK != portfolio_import_res) {
+		printf("Failed to import the portfolio with result %d\n",
+		       portfolio_import_res);
+		exit(1);
+	}
+	// Posting through the loop's ring makes everything we wrote to the portfolio
+	// visible to the loop before it sees the event.
+	const struct event imported = {
+		.tag = TECZKA_EVENT_PORTFOLIO_IMPORTED,
+		.run_timestamp_ms = timestamp_ms_get(),
+		.portfolio_imported_info = { .portfolio = &portfolio },
+	};
+	enum event_loop_post_error post_result = event_loop_post(&imported);
+	if (EVENT_LOOP_POST_ERROR_OK != post_result) {
+		printf("Failed to hand the portfolio to the event loop with result %d\n",
+		       post_result);
+		exit(1);
+	}
+	return NULL;
+}
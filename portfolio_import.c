@@ -272,6 +272,7 @@ _fidelity_equity_fill(struct equity *equity, char *buf)
 	}
 	_ownership_init(&equity->ownership, &values);
 	_valuation_init(&equity->valuation, &values);
+	equity->fetch_partition = 0;
 
 	// Update deltas with new values
 	(void)equity_ownership_deltas_update(&equity->ownership,
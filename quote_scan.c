@@ -0,0 +1,372 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "quote_scan.h"
+
+// Keys we pull values from and the field each one fills.
+struct _quote_key {
+	const char *key;
+	uint32_t key_len;
+	uint32_t field;
+};
+
+static const struct _quote_key QUOTE_KEYS[] = {
+	{ "symbol", 6, QUOTE_FIELD_SYMBOL },
+	{ "regularMarketPrice", 18, QUOTE_FIELD_PRICE },
+	{ "regularMarketPreviousClose", 26, QUOTE_FIELD_CLOSE_PREVIOUS },
+	{ "regularMarketOpen", 17, QUOTE_FIELD_OPEN },
+};
+#define QUOTE_KEYS_LEN (sizeof(QUOTE_KEYS) / sizeof(struct _quote_key))
+#define QUOTE_KEYS_ALL (((uint32_t)1 << QUOTE_KEYS_LEN) - 1)
+// containers_object is a uint64_t and depth 0 is outside every container.
+#define QUOTE_SCAN_DEPTH_MAX (63)
+
+// Handles a character outside of any string or bare value.
+static void _token_char(struct quote_scan *scan, char c);
+static void _key_char(struct quote_scan *scan, char c);
+// Called at the closing quote of a key. Picks the field for the value after it.
+static void _key_finish(struct quote_scan *scan);
+static void _string_char(struct quote_scan *scan, char c);
+// Returns true if c ends a number, true, false or null.
+static int _bare_end(char c);
+static void _container_push(struct quote_scan *scan, int is_object);
+static void _container_pop(struct quote_scan *scan);
+static void _value_start(struct quote_scan *scan);
+static void _value_char(struct quote_scan *scan, char c, int bare);
+// Stores the scanned value in the record if it's one we want and it was valid.
+static void _value_finish(struct quote_scan *scan);
+static void _record_emit(struct quote_scan *scan);
+
+void quote_scan_init(struct quote_scan *scan, quote_scan_record_fn record_fn,
+		     void *record_context)
+{
+	if (NULL == scan) {
+		return;
+	}
+	*scan = (struct quote_scan){
+		.record_fn = record_fn,
+		.record_context = record_context,
+		.state = QUOTE_SCAN_STATE_TOKEN,
+		.error = QUOTE_SCAN_ERROR_OK,
+	};
+}
+
+enum quote_scan_error quote_scan_feed(struct quote_scan *scan, const char *data,
+				      size_t len)
+{
+	if (NULL == scan || (NULL == data && len > 0)) {
+		return QUOTE_SCAN_ERROR_NULL_ARG;
+	}
+	for (size_t i = 0; i < len && QUOTE_SCAN_ERROR_OK == scan->error; ++i) {
+		const char c = data[i];
+		switch (scan->state) {
+		case QUOTE_SCAN_STATE_KEY:
+			_key_char(scan, c);
+			break;
+		case QUOTE_SCAN_STATE_STRING:
+			_string_char(scan, c);
+			break;
+		case QUOTE_SCAN_STATE_BARE:
+			if (!_bare_end(c)) {
+				_value_char(scan, c, 1);
+				break;
+			}
+			_value_finish(scan);
+			scan->state = QUOTE_SCAN_STATE_TOKEN;
+			// The character that ended the value is a token itself.
+			_token_char(scan, c);
+			break;
+		case QUOTE_SCAN_STATE_TOKEN:
+		default:
+			_token_char(scan, c);
+			break;
+		}
+	}
+	return scan->error;
+}
+
+static void _token_char(struct quote_scan *scan, char c)
+{
+	switch (c) {
+	case '{':
+		scan->value_field = 0;
+		_container_push(scan, 1);
+		scan->key_expected = 1;
+		break;
+	case '[':
+		scan->value_field = 0;
+		_container_push(scan, 0);
+		scan->key_expected = 0;
+		break;
+	case '}':
+		if (scan->depth == scan->record_depth) {
+			_record_emit(scan);
+		}
+		_container_pop(scan);
+		scan->key_expected = 0;
+		break;
+	case ']':
+		_container_pop(scan);
+		scan->key_expected = 0;
+		break;
+	case ',':
+		scan->key_expected =
+			(int)((scan->containers_object >> scan->depth) & 1);
+		break;
+	case ':':
+		scan->key_expected = 0;
+		break;
+	case '"':
+		scan->escaped = 0;
+		if (scan->key_expected) {
+			scan->state = QUOTE_SCAN_STATE_KEY;
+			scan->key_candidates = QUOTE_KEYS_ALL;
+			scan->key_len = 0;
+		} else {
+			scan->state = QUOTE_SCAN_STATE_STRING;
+			_value_start(scan);
+		}
+		break;
+	case ' ':
+	case '\t':
+	case '\n':
+	case '\r':
+		break;
+	default:
+		scan->state = QUOTE_SCAN_STATE_BARE;
+		_value_start(scan);
+		_value_char(scan, c, 1);
+		break;
+	}
+}
+
+static void _key_char(struct quote_scan *scan, char c)
+{
+	if (scan->escaped) {
+		// None of our keys have escapes in them.
+		scan->escaped = 0;
+		scan->key_candidates = 0;
+		++scan->key_len;
+		return;
+	}
+	if ('\\' == c) {
+		scan->escaped = 1;
+		return;
+	}
+	if ('"' == c) {
+		_key_finish(scan);
+		return;
+	}
+	uint32_t candidates = scan->key_candidates;
+	while (candidates) {
+		const uint32_t i = (uint32_t)__builtin_ctz(candidates);
+		candidates &= candidates - 1;
+		if (scan->key_len >= QUOTE_KEYS[i].key_len ||
+		    c != QUOTE_KEYS[i].key[scan->key_len]) {
+			scan->key_candidates &= ~((uint32_t)1 << i);
+		}
+	}
+	++scan->key_len;
+}
+
+static void _key_finish(struct quote_scan *scan)
+{
+	scan->state = QUOTE_SCAN_STATE_TOKEN;
+	scan->value_field = 0;
+	uint32_t candidates = scan->key_candidates;
+	while (candidates) {
+		const uint32_t i = (uint32_t)__builtin_ctz(candidates);
+		candidates &= candidates - 1;
+		if (scan->key_len != QUOTE_KEYS[i].key_len) {
+			continue;
+		}
+		// The first object with a field we want is the record. Fields in objects
+		// nested inside it aren't about this quote.
+		if (0 == scan->record_depth) {
+			scan->record_depth = scan->depth;
+		}
+		if (scan->depth == scan->record_depth) {
+			scan->value_field = QUOTE_KEYS[i].field;
+		}
+		return;
+	}
+}
+
+static void _string_char(struct quote_scan *scan, char c)
+{
+	if (scan->escaped) {
+		scan->escaped = 0;
+		// A symbol with an escape in it is not one of our tickers.
+		if (QUOTE_FIELD_SYMBOL == scan->value_field) {
+			scan->value_invalid = 1;
+		}
+		return;
+	}
+	if ('\\' == c) {
+		scan->escaped = 1;
+		return;
+	}
+	if ('"' == c) {
+		_value_finish(scan);
+		scan->state = QUOTE_SCAN_STATE_TOKEN;
+		return;
+	}
+	_value_char(scan, c, 0);
+}
+
+static int _bare_end(char c)
+{
+	switch (c) {
+	case ',':
+	case '}':
+	case ']':
+	case ' ':
+	case '\t':
+	case '\n':
+	case '\r':
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void _container_push(struct quote_scan *scan, int is_object)
+{
+	if (scan->depth >= QUOTE_SCAN_DEPTH_MAX) {
+		scan->error = QUOTE_SCAN_ERROR_TOO_DEEP;
+		return;
+	}
+	++scan->depth;
+	const uint64_t bit = (uint64_t)1 << scan->depth;
+	if (is_object) {
+		scan->containers_object |= bit;
+	} else {
+		scan->containers_object &= ~bit;
+	}
+}
+
+static void _container_pop(struct quote_scan *scan)
+{
+	if (scan->depth > 0) {
+		--scan->depth;
+	}
+}
+
+static void _value_start(struct quote_scan *scan)
+{
+	scan->value_invalid = 0;
+	scan->value_negative = 0;
+	scan->value_digits = 0;
+	scan->value_whole = 0;
+	scan->value_hundredths = 0;
+	scan->value_fraction_digits = -1;
+	scan->value_symbol_len = 0;
+}
+
+static void _value_char(struct quote_scan *scan, char c, int bare)
+{
+	if (0 == scan->value_field || scan->value_invalid) {
+		return;
+	}
+	if (QUOTE_FIELD_SYMBOL == scan->value_field) {
+		if (bare || scan->value_symbol_len >= EQUITY_KEY_BYTES_MAX) {
+			scan->value_invalid = 1;
+			return;
+		}
+		scan->record.symbol[scan->value_symbol_len++] = c;
+		return;
+	}
+	if (c >= '0' && c <= '9') {
+		const int64_t digit = c - '0';
+		++scan->value_digits;
+		switch (scan->value_fraction_digits) {
+		case -1:
+			if (scan->value_whole > (INT64_MAX / 100 - 9) / 10) {
+				scan->value_invalid = 1;
+				return;
+			}
+			scan->value_whole = scan->value_whole * 10 + digit;
+			break;
+		case 0:
+			scan->value_hundredths += digit * 10;
+			scan->value_fraction_digits = 1;
+			break;
+		case 1:
+			scan->value_hundredths += digit;
+			scan->value_fraction_digits = 2;
+			break;
+		default:
+			// Past the hundredths place. Truncate.
+			break;
+		}
+		return;
+	}
+	switch (c) {
+	case '.':
+		if (scan->value_fraction_digits < 0) {
+			scan->value_fraction_digits = 0;
+		}
+		break;
+	case '-':
+		scan->value_negative = 1;
+		break;
+	default:
+		// Strings can have symbols like $ that we skip. A bare value with
+		// anything else is an exponent, true, false or null.
+		if (bare) {
+			scan->value_invalid = 1;
+		}
+		break;
+	}
+}
+
+static void _value_finish(struct quote_scan *scan)
+{
+	const uint32_t field = scan->value_field;
+	scan->value_field = 0;
+	if (0 == field || scan->value_invalid) {
+		return;
+	}
+	if (QUOTE_FIELD_SYMBOL == field) {
+		if (scan->value_symbol_len > 0) {
+			scan->record.symbol[scan->value_symbol_len] = '\0';
+			scan->record.fields |= QUOTE_FIELD_SYMBOL;
+		}
+		return;
+	}
+	if (0 == scan->value_digits) {
+		return;
+	}
+	int64_t cents = scan->value_whole * 100 + scan->value_hundredths;
+	if (scan->value_negative) {
+		cents = -cents;
+	}
+	switch (field) {
+	case QUOTE_FIELD_PRICE:
+		scan->record.price_cents_current = cents;
+		break;
+	case QUOTE_FIELD_CLOSE_PREVIOUS:
+		scan->record.price_cents_close_previous = cents;
+		break;
+	case QUOTE_FIELD_OPEN:
+		scan->record.price_cents_open = cents;
+		break;
+	default:
+		return;
+	}
+	scan->record.fields |= field;
+}
+
+static void _record_emit(struct quote_scan *scan)
+{
+	if (0 != scan->record.fields && NULL != scan->record_fn) {
+		scan->record_fn(&scan->record, scan->record_context);
+	}
+	scan->record = (struct quote_record){ 0 };
+	scan->record_depth = 0;
+}
+
+#undef QUOTE_SCAN_DEPTH_MAX
+#undef QUOTE_KEYS_ALL
+#undef QUOTE_KEYS_LEN
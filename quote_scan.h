@@ -0,0 +1,100 @@
+#ifndef _TECZKA_QUOTE_SCAN_H
+#define _TECZKA_QUOTE_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+// Bits set in quote_record.fields for each value the scanner found.
+enum quote_field {
+	QUOTE_FIELD_SYMBOL = (1 << 0),
+	QUOTE_FIELD_PRICE = (1 << 1),
+	QUOTE_FIELD_CLOSE_PREVIOUS = (1 << 2),
+	QUOTE_FIELD_OPEN = (1 << 3),
+};
+
+// The values pulled out of one quote object in the response. Prices are in cents.
+struct quote_record {
+	char symbol[EQUITY_KEY_BYTES_MAX + 1];
+	int64_t price_cents_current;
+	int64_t price_cents_close_previous;
+	int64_t price_cents_open;
+	uint32_t fields;
+};
+
+// Called once for every object in the response that had at least one of the fields
+// we look for. record is only valid during the call.
+typedef void (*quote_scan_record_fn)(const struct quote_record *record,
+				     void *context);
+
+enum quote_scan_state {
+	QUOTE_SCAN_STATE_TOKEN = 0, // Between tokens
+	QUOTE_SCAN_STATE_KEY, // Inside an object key
+	QUOTE_SCAN_STATE_STRING, // Inside a string value
+	QUOTE_SCAN_STATE_BARE, // Inside a number, true, false or null
+};
+
+enum quote_scan_error {
+	QUOTE_SCAN_ERROR_OK = 0,
+	QUOTE_SCAN_ERROR_NULL_ARG,
+	QUOTE_SCAN_ERROR_TOO_DEEP,
+};
+
+/* quote_scan pulls quote fields out of a Yahoo style quote response as the bytes
+ * arrive. It is not a JSON parser. It tracks just enough (string/key state and
+ * container nesting) to find the keys it cares about and turns their values into
+ * fixed point as it goes. Nothing is allocated and no part of the body is copied
+ * except the symbol, so it can run on each chunk CURL hands the write callback.
+ * All the state needed to pick up in the middle of a token is kept here.
+ *
+ * Keys are matched a byte at a time against every field's key at once with a mask
+ * of the keys still possible. Numbers are converted with the same rules as
+ * string_to_int64_hundredths: digits past the hundredths place are truncated and
+ * other characters are ignored. A number with an exponent is thrown out since
+ * truncating it would give a wrong price.
+ */
+struct quote_scan {
+	quote_scan_record_fn record_fn;
+	void *record_context;
+	struct quote_record record;
+	enum quote_scan_state state;
+	enum quote_scan_error error;
+	// Bit d is set if the container at depth d is an object.
+	uint64_t containers_object;
+	uint32_t depth;
+	// Depth of the object the current record comes from. 0 when no record is open.
+	uint32_t record_depth;
+	// The next string in the current object is a key.
+	int key_expected;
+	// The last character in a string was a backslash.
+	int escaped;
+	// Keys the current key string could still be. Bit i is quote_scan's key i.
+	uint32_t key_candidates;
+	uint32_t key_len;
+	// Field the value being scanned goes into. 0 if we don't want it.
+	uint32_t value_field;
+	int value_invalid;
+	int value_negative;
+	uint32_t value_digits;
+	int64_t value_whole;
+	int64_t value_hundredths;
+	// Digits seen after the decimal point. -1 before the decimal point.
+	int value_fraction_digits;
+	size_t value_symbol_len;
+};
+
+// Resets scan to the start of a response. record_fn is called with record_context.
+void quote_scan_init(struct quote_scan *scan, quote_scan_record_fn record_fn,
+		     void *record_context);
+
+/* Scans the next len bytes of the response. Chunks can split tokens anywhere.
+ * @returns QUOTE_SCAN_ERROR_OK or the error that stopped the scan. Once scanning
+ * stops, every call returns the same error until quote_scan_init is called again.
+ * @error QUOTE_SCAN_ERROR_NULL_ARG: scan is NULL or data is NULL with a nonzero len.
+ * @error QUOTE_SCAN_ERROR_TOO_DEEP: The response nests deeper than 63 containers.
+ */
+enum quote_scan_error quote_scan_feed(struct quote_scan *scan, const char *data,
+				      size_t len);
+
+#endif // _TECZKA_QUOTE_SCAN_H
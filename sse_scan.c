@@ -0,0 +1,120 @@
+#include <stddef.h>
+
+#include "quote_scan.h"
+#include "sse_scan.h"
+
+#define SSE_FIELD_DATA "data"
+#define SSE_FIELD_DATA_LEN (sizeof(SSE_FIELD_DATA) - 1)
+
+// Called at a CR or LF. A line with nothing on it ends the event.
+static void _line_end(struct sse_scan *scan);
+static void _field_char(struct sse_scan *scan, char c);
+// Returns where the line that data[start] is on ends. len if it goes past data.
+static size_t _line_end_find(const char *data, size_t start, size_t len);
+
+void sse_scan_init(struct sse_scan *scan, struct quote_scan *quote_scan)
+{
+	if (NULL == scan) {
+		return;
+	}
+	*scan = (struct sse_scan){
+		.quote_scan = quote_scan,
+		.state = SSE_SCAN_STATE_FIELD,
+		.field_data = 1,
+	};
+}
+
+enum sse_scan_error sse_scan_feed(struct sse_scan *scan, const char *data,
+				  size_t len)
+{
+	if (NULL == scan || NULL == scan->quote_scan ||
+	    (NULL == data && len > 0)) {
+		return SSE_SCAN_ERROR_NULL_ARG;
+	}
+	size_t i = 0;
+	while (i < len) {
+		const char c = data[i];
+		if (scan->cr) {
+			scan->cr = 0;
+			if ('\n' == c) {
+				++i;
+				continue;
+			}
+		}
+		if ('\r' == c || '\n' == c) {
+			scan->cr = '\r' == c;
+			_line_end(scan);
+			++i;
+			continue;
+		}
+		size_t end;
+		switch (scan->state) {
+		case SSE_SCAN_STATE_FIELD:
+			_field_char(scan, c);
+			++i;
+			break;
+		case SSE_SCAN_STATE_DATA:
+			if (scan->value_start && ' ' == c) {
+				++i;
+			}
+			scan->value_start = 0;
+			// Hand quote_scan the rest of the line in one go.
+			end = _line_end_find(data, i, len);
+			(void)quote_scan_feed(scan->quote_scan, data + i, end - i);
+			i = end;
+			break;
+		case SSE_SCAN_STATE_SKIP:
+		default:
+			i = _line_end_find(data, i, len);
+			break;
+		}
+	}
+	return SSE_SCAN_ERROR_OK;
+}
+
+static void _line_end(struct sse_scan *scan)
+{
+	if (SSE_SCAN_STATE_FIELD == scan->state && 0 == scan->field_len) {
+		struct quote_scan *quote_scan = scan->quote_scan;
+		quote_scan_init(quote_scan, quote_scan->record_fn,
+				quote_scan->record_context);
+		scan->event_data = 0;
+	}
+	// A field name with no colon has an empty value. That's nothing to us even if
+	// it's data.
+	scan->state = SSE_SCAN_STATE_FIELD;
+	scan->field_len = 0;
+	scan->field_data = 1;
+}
+
+static void _field_char(struct sse_scan *scan, char c)
+{
+	if (':' != c) {
+		scan->field_data = scan->field_data &&
+				   scan->field_len < SSE_FIELD_DATA_LEN &&
+				   SSE_FIELD_DATA[scan->field_len] == c;
+		++scan->field_len;
+		return;
+	}
+	// A line starting with a colon is a comment.
+	if (0 == scan->field_len || !scan->field_data ||
+	    SSE_FIELD_DATA_LEN != scan->field_len) {
+		scan->state = SSE_SCAN_STATE_SKIP;
+		return;
+	}
+	if (scan->event_data) {
+		(void)quote_scan_feed(scan->quote_scan, "\n", 1);
+	}
+	scan->event_data = 1;
+	scan->value_start = 1;
+	scan->state = SSE_SCAN_STATE_DATA;
+}
+
+static size_t _line_end_find(const char *data, size_t start, size_t len)
+{
+	size_t end = start;
+	while (end < len && '\r' != data[end] && '\n' != data[end]) {
+		++end;
+	}
+	return end;
+}
@@ -0,0 +1,55 @@
+#ifndef _TECZKA_SSE_SCAN_H
+#define _TECZKA_SSE_SCAN_H
+
+#include <stddef.h>
+
+#include "quote_scan.h"
+
+enum sse_scan_state {
+	SSE_SCAN_STATE_FIELD = 0, // Reading the field name at the start of a line
+	SSE_SCAN_STATE_DATA, // Inside the value of a data line
+	SSE_SCAN_STATE_SKIP, // Inside a comment or a field we don't use
+};
+
+enum sse_scan_error {
+	SSE_SCAN_ERROR_OK = 0,
+	SSE_SCAN_ERROR_NULL_ARG,
+};
+
+/* sse_scan splits a Server-Sent Events stream into events as the bytes arrive and
+ * feeds the data of each one to a quote_scan. Data lines of one event are joined
+ * with a newline like the spec says, so an event can spread its JSON over several
+ * lines. The quote_scan is reset at the end of every event so a bad event doesn't
+ * stop the ones after it. Comments (lines starting with ':', usually heartbeats)
+ * and the event, id and retry fields are skipped. Like quote_scan, nothing is
+ * copied or allocated and chunks can split a line anywhere.
+ */
+struct sse_scan {
+	struct quote_scan *quote_scan;
+	enum sse_scan_state state;
+	// Bytes of the field name on this line so far and whether they could still be
+	// "data".
+	size_t field_len;
+	int field_data;
+	// The optional space after "data:" hasn't been looked for yet.
+	int value_start;
+	// The last line ended with a CR. A LF right after it belongs to the same line
+	// end.
+	int cr;
+	// A data line of the current event was already fed to quote_scan.
+	int event_data;
+};
+
+// Resets scan to the start of a stream. quote_scan gets the data of every event.
+void sse_scan_init(struct sse_scan *scan, struct quote_scan *quote_scan);
+
+/* Scans the next len bytes of the stream.
+ * @returns SSE_SCAN_ERROR_OK or an error.
+ * @error SSE_SCAN_ERROR_NULL_ARG: scan is NULL, data is NULL with a nonzero len or
+ * scan was never given a quote_scan.
+ * Errors from quote_scan only throw out the event they happened in.
+ */
+enum sse_scan_error sse_scan_feed(struct sse_scan *scan, const char *data,
+				  size_t len);
+
+#endif // _TECZKA_SSE_SCAN_H
@@ -1,7 +1,19 @@
+// Needed for MAP_ANONYMOUS with -std=c11.
+#define _DEFAULT_SOURCE
+
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
 
 #include "static_mem_cache.h"
 
+// Rounds bytes up so what follows is aligned for any type.
+#define MAX_ALIGN_UP(bytes) \
+	(((bytes) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
 // This function intializes the free list for buffer and returns the pointer
 // that was not added to the free list.
 static void *_buffer_init_free_list(void *buffer, size_t buffer_size_bytes,
@@ -11,14 +23,51 @@ static void *_buffer_init_free_list(void *buffer, size_t buffer_size_bytes,
 // buffer is not NULL, the size members are not 0, etc.
 static int _static_mem_cache_valid(const struct static_mem_cache *cache);
 
-// Returns true if the ptr is in the cache's free list.
-static int _ptr_in_free_list(const struct static_mem_cache *cache,
-			     const void *ptr);
+/* Works out where a slab's elements start and returns how many fit. With
+ * STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE the slab's bitmap comes first.
+ */
+static size_t _slab_layout_get(size_t element_size_bytes, size_t flags,
+			       size_t *elements_offset);
+
+// Bitmap helpers for the allocated element bitmaps.
+static int _bit_test(const uint64_t *bitmap, size_t index);
+static void _bit_set(uint64_t *bitmap, size_t index);
+static void _bit_clear(uint64_t *bitmap, size_t index);
+
+// Returns true if ptr is inside the cache's static buffer.
+static int _ptr_in_buffer(const struct static_mem_cache *cache,
+			  const void *ptr);
+
+// Growable cache functions. These are the slow path. They only run once buffer is
+// used up.
+static void *_slab_malloc(struct static_mem_cache *cache);
+static enum static_mem_cache_free_error
+_slab_free(struct static_mem_cache *cache, void *ptr);
+// Maps a new slab aligned to STATIC_MEM_CACHE_SLAB_BYTES, registers it and links
+// it into slabs_partial. Returns NULL if mmap fails or slabs can't grow.
+static struct static_mem_cache_slab *
+_slab_create(struct static_mem_cache *cache);
+// Returns where slab is or would go in the cache's sorted slabs.
+static size_t _slab_index_get(const struct static_mem_cache *cache,
+			      const struct static_mem_cache_slab *slab);
+// Returns true if slab is one of the cache's mapped slabs.
+static int _slab_registered(const struct static_mem_cache *cache,
+			    const struct static_mem_cache_slab *slab);
+// Removes slab from the cache's slabs and unmaps it.
+static void _slab_destroy(struct static_mem_cache *cache,
+			  struct static_mem_cache_slab *slab);
+static void _slab_partial_link(struct static_mem_cache *cache,
+			       struct static_mem_cache_slab *slab);
+static void _slab_partial_unlink(struct static_mem_cache *cache,
+				 struct static_mem_cache_slab *slab);
+// Unmaps every empty slab.
+static void _slabs_empty_release(struct static_mem_cache *cache);
 
 enum static_mem_cache_init_error
 static_mem_cache_init(struct static_mem_cache *cache, void *buffer,
 		      size_t buffer_elements_count,
-		      size_t buffer_element_size_bytes, size_t flags)
+		      size_t buffer_element_size_bytes,
+		      uint64_t *allocated_bitmap, size_t flags)
 {
 	if (NULL == cache) {
 		return STATIC_MEM_CACHE_INIT_ERROR_NULL_CACHE;
@@ -29,11 +78,39 @@ static_mem_cache_init(struct static_mem_cache *cache, void *buffer,
 	if (buffer_element_size_bytes < sizeof(void *)) {
 		return STATIC_MEM_CACHE_INIT_ERROR_ELEMENT_TOO_SMALL;
 	}
+	size_t slab_elements_offset = 0;
+	const size_t slab_elements_count = _slab_layout_get(
+		buffer_element_size_bytes, flags, &slab_elements_offset);
+	if (flags & STATIC_MEM_CACHE_FLAG_GROWABLE &&
+	    0 == slab_elements_count) {
+		return STATIC_MEM_CACHE_INIT_ERROR_ELEMENT_TOO_LARGE;
+	}
+	if (flags & STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE &&
+	    NULL == allocated_bitmap) {
+		return STATIC_MEM_CACHE_INIT_ERROR_NO_BITMAP;
+	}
 	cache->buffer = buffer;
 	cache->buffer_size_bytes =
 		buffer_elements_count * buffer_element_size_bytes;
 	cache->buffer_element_size_bytes = buffer_element_size_bytes;
 	cache->flags = flags;
+	cache->allocated = NULL;
+	if (flags & STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE) {
+		cache->allocated = allocated_bitmap;
+		const size_t bitmap_words =
+			STATIC_MEM_CACHE_BITMAP_WORDS(buffer_elements_count);
+		(void)memset(allocated_bitmap, 0,
+			     bitmap_words * sizeof(uint64_t));
+	}
+	cache->used_count = 0;
+	cache->slabs_partial = NULL;
+	cache->slabs = NULL;
+	cache->slabs_len = 0;
+	cache->slabs_cap = 0;
+	cache->slabs_empty_count = 0;
+	cache->low_water_count = buffer_elements_count / 2;
+	cache->slab_elements_offset = slab_elements_offset;
+	cache->slab_elements_count = slab_elements_count;
 
 	void *const unadded_free_ptr = _buffer_init_free_list(
 		buffer, cache->buffer_size_bytes, buffer_element_size_bytes);
@@ -54,12 +131,21 @@ static_mem_cache_malloc(struct static_mem_cache *cache)
 		return result;
 	}
 	if (NULL == cache->first_free) {
-		result.error = STATIC_MEM_CACHE_MALLOC_ERROR_OOM;
+		result.ptr = _slab_malloc(cache);
+		result.error = NULL == result.ptr ?
+				       STATIC_MEM_CACHE_MALLOC_ERROR_OOM :
+				       STATIC_MEM_CACHE_MALLOC_ERROR_OK;
 		return result;
 	}
 	result.error = STATIC_MEM_CACHE_MALLOC_ERROR_OK;
 	result.ptr = cache->first_free;
 	cache->first_free = *(void **)result.ptr;
+	++cache->used_count;
+	if (cache->flags & STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE) {
+		_bit_set(cache->allocated,
+			 ((uintptr_t)result.ptr - (uintptr_t)cache->buffer) /
+				 cache->buffer_element_size_bytes);
+	}
 
 	return result;
 }
@@ -76,18 +162,27 @@ static_mem_cache_free(struct static_mem_cache *cache, void *ptr)
 	if (!_static_mem_cache_valid(cache)) {
 		return STATIC_MEM_CACHE_FREE_ERROR_CORRUPTED_CACHE;
 	}
-	const void *const buffer_end_exclusive =
-		(void *)((size_t)cache->buffer + cache->buffer_size_bytes);
-	if (ptr < cache->buffer && ptr >= buffer_end_exclusive) {
+	if (!_ptr_in_buffer(cache, ptr)) {
+		if (cache->flags & STATIC_MEM_CACHE_FLAG_GROWABLE) {
+			return _slab_free(cache, ptr);
+		}
 		return STATIC_MEM_CACHE_FREE_ERROR_NOT_IN_BUFFER;
 	}
-	if (cache->flags & STATIC_MEM_CACHE_FLAG_CHECK_FREE_LIST_ON_FREE &&
-	    _ptr_in_free_list(cache, ptr)) {
-		return STATIC_MEM_CACHE_FREE_ERROR_IN_FREE_LIST;
+	const size_t offset = (uintptr_t)ptr - (uintptr_t)cache->buffer;
+	const size_t index = offset / cache->buffer_element_size_bytes;
+	if (index * cache->buffer_element_size_bytes != offset) {
+		return STATIC_MEM_CACHE_FREE_ERROR_MISALIGNED;
+	}
+	if (cache->flags & STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE) {
+		if (!_bit_test(cache->allocated, index)) {
+			return STATIC_MEM_CACHE_FREE_ERROR_IN_FREE_LIST;
+		}
+		_bit_clear(cache->allocated, index);
 	}
 
 	*(void **)ptr = cache->first_free;
 	cache->first_free = ptr;
+	--cache->used_count;
 	return STATIC_MEM_CACHE_FREE_ERROR_OK;
 }
 
@@ -110,18 +205,256 @@ static void *_buffer_init_free_list(void *buffer, size_t buffer_size_bytes,
 static int _static_mem_cache_valid(const struct static_mem_cache *cache)
 {
 	return NULL != cache->buffer && cache->buffer_size_bytes > 0 &&
-	       cache->buffer_element_size_bytes > 0;
+	       cache->buffer_element_size_bytes > 0 &&
+	       (!(cache->flags & STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE) ||
+		NULL != cache->allocated);
+}
+
+static size_t _slab_layout_get(size_t element_size_bytes, size_t flags,
+			       size_t *elements_offset)
+{
+	const size_t header_bytes = sizeof(struct static_mem_cache_slab);
+	size_t bitmap_bytes = 0;
+	if (flags & STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE) {
+		// Size the bitmap for the elements that would fit without it.
+		// That's never fewer than fit with it.
+		const size_t elements_count_max = (STATIC_MEM_CACHE_SLAB_BYTES -
+						   MAX_ALIGN_UP(header_bytes)) /
+						  element_size_bytes;
+		bitmap_bytes =
+			STATIC_MEM_CACHE_BITMAP_WORDS(elements_count_max) *
+			sizeof(uint64_t);
+	}
+	*elements_offset = MAX_ALIGN_UP(header_bytes + bitmap_bytes);
+	if (*elements_offset >= STATIC_MEM_CACHE_SLAB_BYTES) {
+		return 0;
+	}
+	return (STATIC_MEM_CACHE_SLAB_BYTES - *elements_offset) /
+	       element_size_bytes;
+}
+
+static int _bit_test(const uint64_t *bitmap, size_t index)
+{
+	return 0 != (bitmap[index / 64] & ((uint64_t)1 << (index % 64)));
 }
 
-static int _ptr_in_free_list(const struct static_mem_cache *cache,
-			     const void *ptr)
+static void _bit_set(uint64_t *bitmap, size_t index)
 {
-	const void *first_free = cache->first_free;
-	while (NULL != first_free) {
-		if (first_free == ptr) {
-			return 1;
+	bitmap[index / 64] |= (uint64_t)1 << (index % 64);
+}
+
+static void _bit_clear(uint64_t *bitmap, size_t index)
+{
+	bitmap[index / 64] &= ~((uint64_t)1 << (index % 64));
+}
+
+static int _ptr_in_buffer(const struct static_mem_cache *cache,
+			  const void *ptr)
+{
+	const uintptr_t start = (uintptr_t)cache->buffer;
+	const uintptr_t end_exclusive = start + cache->buffer_size_bytes;
+	return (uintptr_t)ptr >= start && (uintptr_t)ptr < end_exclusive;
+}
+
+static void *_slab_malloc(struct static_mem_cache *cache)
+{
+	if (!(cache->flags & STATIC_MEM_CACHE_FLAG_GROWABLE)) {
+		return NULL;
+	}
+	struct static_mem_cache_slab *slab = cache->slabs_partial;
+	if (NULL == slab) {
+		slab = _slab_create(cache);
+		if (NULL == slab) {
+			return NULL;
 		}
-		first_free = *(void **)first_free;
 	}
-	return 0;
+	if (0 == slab->used_count) {
+		--cache->slabs_empty_count;
+	}
+	void *ptr = slab->first_free;
+	slab->first_free = *(void **)ptr;
+	++slab->used_count;
+	++cache->used_count;
+	if (cache->flags & STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE) {
+		_bit_set(slab->allocated,
+			 ((uintptr_t)ptr - (uintptr_t)slab -
+			  cache->slab_elements_offset) /
+				 cache->buffer_element_size_bytes);
+	}
+	if (NULL == slab->first_free) {
+		_slab_partial_unlink(cache, slab);
+	}
+	return ptr;
 }
+
+static enum static_mem_cache_free_error
+_slab_free(struct static_mem_cache *cache, void *ptr)
+{
+	struct static_mem_cache_slab *slab =
+		(struct static_mem_cache_slab *)((uintptr_t)ptr &
+						 ~(STATIC_MEM_CACHE_SLAB_BYTES -
+						   1));
+	if ((uintptr_t)ptr - (uintptr_t)slab < cache->slab_elements_offset ||
+	    !_slab_registered(cache, slab)) {
+		return STATIC_MEM_CACHE_FREE_ERROR_NOT_IN_BUFFER;
+	}
+	const size_t offset =
+		(uintptr_t)ptr - (uintptr_t)slab - cache->slab_elements_offset;
+	const size_t index = offset / cache->buffer_element_size_bytes;
+	if (index >= cache->slab_elements_count) {
+		// The slack after the last element.
+		return STATIC_MEM_CACHE_FREE_ERROR_NOT_IN_BUFFER;
+	}
+	if (index * cache->buffer_element_size_bytes != offset) {
+		return STATIC_MEM_CACHE_FREE_ERROR_MISALIGNED;
+	}
+	if (cache->flags & STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE) {
+		if (!_bit_test(slab->allocated, index)) {
+			return STATIC_MEM_CACHE_FREE_ERROR_IN_FREE_LIST;
+		}
+		_bit_clear(slab->allocated, index);
+	}
+	if (NULL == slab->first_free) {
+		_slab_partial_link(cache, slab);
+	}
+	*(void **)ptr = slab->first_free;
+	slab->first_free = ptr;
+	--slab->used_count;
+	--cache->used_count;
+	if (0 == slab->used_count) {
+		++cache->slabs_empty_count;
+	}
+	if (cache->slabs_empty_count > 0 &&
+	    cache->used_count < cache->low_water_count) {
+		_slabs_empty_release(cache);
+	}
+	return STATIC_MEM_CACHE_FREE_ERROR_OK;
+}
+
+static struct static_mem_cache_slab *
+_slab_create(struct static_mem_cache *cache)
+{
+	if (cache->slabs_len == cache->slabs_cap) {
+		const size_t slabs_cap =
+			0 == cache->slabs_cap ? 8 : 2 * cache->slabs_cap;
+		struct static_mem_cache_slab **slabs =
+			realloc(cache->slabs, slabs_cap * sizeof(*slabs));
+		if (NULL == slabs) {
+			return NULL;
+		}
+		cache->slabs = slabs;
+		cache->slabs_cap = slabs_cap;
+	}
+	// mmap only promises page alignment. Map twice the size and trim the ends so
+	// what's left is aligned to its size.
+	const size_t map_bytes = 2 * STATIC_MEM_CACHE_SLAB_BYTES;
+	void *map = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == map) {
+		return NULL;
+	}
+	const uintptr_t map_start = (uintptr_t)map;
+	const uintptr_t slab_start =
+		(map_start + STATIC_MEM_CACHE_SLAB_BYTES - 1) &
+		~(STATIC_MEM_CACHE_SLAB_BYTES - 1);
+	const uintptr_t slab_end = slab_start + STATIC_MEM_CACHE_SLAB_BYTES;
+	if (slab_start > map_start) {
+		(void)munmap(map, slab_start - map_start);
+	}
+	if (map_start + map_bytes > slab_end) {
+		(void)munmap((void *)slab_end, map_start + map_bytes - slab_end);
+	}
+
+	// Anonymous mappings start zeroed so the slab's bitmap is already clear.
+	struct static_mem_cache_slab *slab =
+		(struct static_mem_cache_slab *)slab_start;
+	const size_t index = _slab_index_get(cache, slab);
+	(void)memmove(&cache->slabs[index + 1], &cache->slabs[index],
+		      (cache->slabs_len - index) * sizeof(*cache->slabs));
+	cache->slabs[index] = slab;
+	++cache->slabs_len;
+	slab->used_count = 0;
+	slab->first_free = _buffer_init_free_list(
+		(void *)(slab_start + cache->slab_elements_offset),
+		cache->slab_elements_count * cache->buffer_element_size_bytes,
+		cache->buffer_element_size_bytes);
+	_slab_partial_link(cache, slab);
+	++cache->slabs_empty_count;
+	return slab;
+}
+
+static size_t _slab_index_get(const struct static_mem_cache *cache,
+			      const struct static_mem_cache_slab *slab)
+{
+	size_t low = 0;
+	size_t high = cache->slabs_len;
+	while (low < high) {
+		const size_t mid = low + (high - low) / 2;
+		if ((uintptr_t)cache->slabs[mid] < (uintptr_t)slab) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+static int _slab_registered(const struct static_mem_cache *cache,
+			    const struct static_mem_cache_slab *slab)
+{
+	const size_t index = _slab_index_get(cache, slab);
+	return index < cache->slabs_len && slab == cache->slabs[index];
+}
+
+static void _slab_destroy(struct static_mem_cache *cache,
+			  struct static_mem_cache_slab *slab)
+{
+	const size_t index = _slab_index_get(cache, slab);
+	(void)memmove(&cache->slabs[index], &cache->slabs[index + 1],
+		      (cache->slabs_len - index - 1) * sizeof(*cache->slabs));
+	--cache->slabs_len;
+	(void)munmap(slab, STATIC_MEM_CACHE_SLAB_BYTES);
+}
+
+static void _slab_partial_link(struct static_mem_cache *cache,
+			       struct static_mem_cache_slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = cache->slabs_partial;
+	if (NULL != cache->slabs_partial) {
+		cache->slabs_partial->prev = slab;
+	}
+	cache->slabs_partial = slab;
+}
+
+static void _slab_partial_unlink(struct static_mem_cache *cache,
+				 struct static_mem_cache_slab *slab)
+{
+	if (NULL != slab->prev) {
+		slab->prev->next = slab->next;
+	} else {
+		cache->slabs_partial = slab->next;
+	}
+	if (NULL != slab->next) {
+		slab->next->prev = slab->prev;
+	}
+	slab->prev = NULL;
+	slab->next = NULL;
+}
+
+static void _slabs_empty_release(struct static_mem_cache *cache)
+{
+	// Empty slabs always have free elements so they're all in slabs_partial.
+	struct static_mem_cache_slab *slab = cache->slabs_partial;
+	while (NULL != slab) {
+		struct static_mem_cache_slab *next = slab->next;
+		if (0 == slab->used_count) {
+			_slab_partial_unlink(cache, slab);
+			--cache->slabs_empty_count;
+			_slab_destroy(cache, slab);
+		}
+		slab = next;
+	}
+}
+
+#undef _DEFAULT_SOURCE
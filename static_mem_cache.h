@@ -2,6 +2,28 @@
 #define _TECZKA_STATIC_MEM_CACHE_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+// Size and alignment of the slabs a growable cache maps when its buffer runs out.
+// Slabs are aligned to their size so free can find a pointer's slab with a mask.
+#define STATIC_MEM_CACHE_SLAB_BYTES ((size_t)64 * 1024)
+
+// Header at the start of every slab. The elements follow it.
+struct static_mem_cache_slab {
+	// Links in the cache's list of slabs that have free elements.
+	struct static_mem_cache_slab *prev;
+	struct static_mem_cache_slab *next;
+	void *first_free;
+	size_t used_count;
+	// Bit i is set while the slab's element i is allocated. Only there with
+	// STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE.
+	uint64_t allocated[];
+};
+
+// Words of bitmap STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE needs for a buffer of
+// elements_count elements.
+#define STATIC_MEM_CACHE_BITMAP_WORDS(elements_count) \
+	(((elements_count) + 63) / 64)
 
 /* static_mem_cache is a struct that stores the necessary information to
  * allocate and free from static buffer.
@@ -16,10 +38,36 @@ struct static_mem_cache {
 	size_t buffer_size_bytes;
 	size_t buffer_element_size_bytes;
 	size_t flags;
+	// Bit i is set while buffer's element i is allocated. NULL unless
+	// STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE is set.
+	uint64_t *allocated;
+	// Number of elements allocated from buffer and slabs.
+	size_t used_count;
+	// The rest is only used with STATIC_MEM_CACHE_FLAG_GROWABLE. Slabs with a free
+	// element are in slabs_partial. Full slabs aren't linked anywhere until an
+	// element in them is freed.
+	struct static_mem_cache_slab *slabs_partial;
+	// Every mapped slab, full ones included, sorted by address. free looks a
+	// pointer's slab up in here before it reads the slab's header.
+	struct static_mem_cache_slab **slabs;
+	size_t slabs_len;
+	size_t slabs_cap;
+	size_t slabs_empty_count;
+	// Empty slabs are unmapped once used_count is below this.
+	size_t low_water_count;
+	// Where a slab's elements start and how many fit. The slab's bitmap sits
+	// between its header and its elements.
+	size_t slab_elements_offset;
+	size_t slab_elements_count;
 };
 
 enum static_mem_cache_flags {
-	STATIC_MEM_CACHE_FLAG_CHECK_FREE_LIST_ON_FREE = (1 << 0),
+	// Track allocated elements in a bitmap so free can reject a pointer that's
+	// already free. It's O(1) so it's cheap enough to leave on.
+	STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE = (1 << 0),
+	// Map extra slabs when buffer runs out instead of returning OOM. Allocation
+	// still pops from buffer's free list first so the common case is unchanged.
+	STATIC_MEM_CACHE_FLAG_GROWABLE = (1 << 1),
 };
 
 enum static_mem_cache_init_error {
@@ -27,6 +75,8 @@ enum static_mem_cache_init_error {
 	STATIC_MEM_CACHE_INIT_ERROR_NULL_CACHE,
 	STATIC_MEM_CACHE_INIT_ERROR_NO_BUFFER,
 	STATIC_MEM_CACHE_INIT_ERROR_ELEMENT_TOO_SMALL,
+	STATIC_MEM_CACHE_INIT_ERROR_ELEMENT_TOO_LARGE,
+	STATIC_MEM_CACHE_INIT_ERROR_NO_BITMAP,
 };
 
 enum static_mem_cache_malloc_error {
@@ -45,6 +95,7 @@ enum static_mem_cache_free_error {
 	STATIC_MEM_CACHE_FREE_ERROR_NULL_CACHE,
 	STATIC_MEM_CACHE_FREE_ERROR_CORRUPTED_CACHE,
 	STATIC_MEM_CACHE_FREE_ERROR_NOT_IN_BUFFER,
+	STATIC_MEM_CACHE_FREE_ERROR_MISALIGNED,
 	STATIC_MEM_CACHE_FREE_ERROR_IN_FREE_LIST,
 };
 
@@ -58,17 +109,30 @@ enum static_mem_cache_free_error {
  * @param buffer_element_size_bytes: The size (in bytes) of each individual element in
  * the array buffer. This number must be >= sizeof(void *). An embedded free list is used
  * to minimize overhead.
+ * @param allocated_bitmap: STATIC_MEM_CACHE_BITMAP_WORDS(buffer_elements_count) words
+ * the cache tracks allocated elements in. Like buffer, it belongs to the cache after
+ * this. Only needed with STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE, otherwise pass NULL.
  * @returns A static_mem_cache_init_error enum. STATIC_MEM_CACHE_INIT_ERROR_OK indicates no error.
  * @error STATIC_MEM_CACHE_INIT_ERROR_NULL_CACHE: cache arg is NULL.
  * @error STATIC_MEM_CACHE_INIT_ERROR_NULL_BUFFER: buffer arg is NULL.
  * @error STATIC_MEM_CACHE_INIT_ERROR_ELEMENT_TOO_SMALL: The size of the element is too small to
  * contain a pointer. Since we use an embedded free list, this memory allocator will not
  * work with this type.
+ * @error STATIC_MEM_CACHE_INIT_ERROR_ELEMENT_TOO_LARGE: STATIC_MEM_CACHE_FLAG_GROWABLE is
+ * set but an element doesn't fit in a slab.
+ * @error STATIC_MEM_CACHE_INIT_ERROR_NO_BITMAP: STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE is
+ * set but allocated_bitmap is NULL.
+ *
+ * With STATIC_MEM_CACHE_FLAG_GROWABLE, the cache maps STATIC_MEM_CACHE_SLAB_BYTES slabs
+ * when buffer is used up. A slab is unmapped when it is empty and fewer than half of
+ * buffer's elements are in use, so a burst doesn't keep its memory forever and we
+ * don't map and unmap a slab over and over around the edge of buffer.
  */
 enum static_mem_cache_init_error
 static_mem_cache_init(struct static_mem_cache *cache, void *buffer,
 		      size_t buffer_elements_count,
-		      size_t buffer_element_size_bytes, size_t flags);
+		      size_t buffer_element_size_bytes,
+		      uint64_t *allocated_bitmap, size_t flags);
 
 /* Allocate memory from the buffer controlled by the static_mem_cache cache.
  * @param cache: Nonnull pointer to the initialized static_mem_cache.
@@ -80,7 +144,8 @@ static_mem_cache_init(struct static_mem_cache *cache, void *buffer,
  * @error STATIC_MEM_CACHE_MALLOC_ERROR_NULL_CACHE: The arg cache was NULL.
  * @error STATIC_MEM_CACHE_MALLOC_ERROR_CORRUPTED_CACHE: The cache has a NULL buffer.
  * This could mean it wasn't initialized or something else.
- * @error STATIC_MEM_CACHE_MALLOC_ERROR_OOM: There is no free memory in buffer.
+ * @error STATIC_MEM_CACHE_MALLOC_ERROR_OOM: There is no free memory in buffer. For
+ * growable caches, this means mapping a new slab or growing the slab list failed.
  */
 struct static_mem_cache_malloc_result
 static_mem_cache_malloc(struct static_mem_cache *cache);
@@ -95,12 +160,15 @@ static_mem_cache_malloc(struct static_mem_cache *cache);
  * @error STATIC_MEM_CACHE_FREE_ERROR_CORRUPTED_CACHE: The cache has a NULL buffer.
  * This could mean it wasn't initialized or something else.
  * @error STATIC_MEM_CACHE_FREE_ERROR_NOT_IN_BUFFER: The pointer ptr was not within the
- * bounds of the buffer.
+ * bounds of the buffer. For growable caches, ptr must come from buffer or one of the
+ * cache's slabs. Slabs are looked up by address so a pointer from somewhere else
+ * is never dereferenced.
+ * @error STATIC_MEM_CACHE_FREE_ERROR_MISALIGNED: ptr is in the buffer or a slab but
+ * doesn't point at the start of an element.
  * @error STATIC_MEM_CACHE_FREE_ERROR_IN_FREE_LIST: The pointer ptr is in the buffer
- * but is already in the free list. This error is only returned if the flag 
- * STATIC_MEM_CACHE_FLAG_CHECK_FREE_LIST_ON_FREE is enabled for cache. This is recommended
- * because it can help catch bugs, but it makes this function's time complexity O(n) instead
- * of O(1).
+ * but is already free. This error is only returned if the flag
+ * STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE is enabled for cache. This is recommended
+ * because it can help catch bugs, and checking the bitmap keeps free O(1).
  */
 enum static_mem_cache_free_error
 static_mem_cache_free(struct static_mem_cache *cache, void *ptr);
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Runs the polling fetch path on every event loop backend against
+# tests/quote_server.py: level and edge-triggered epoll and io_uring. Each build has
+# to display the quotes and keep polling, with the provider answering 304 once
+# quotes stop changing. Needs python3 and, for io_uring, Linux 5.13 or newer.
+# BACKEND_SERVER_PORT picks the port.
+
+. "$(dirname "$0")/stand_in.sh"
+
+PORT=${BACKEND_SERVER_PORT:-18081}
+URL="\"http://127.0.0.1:$PORT/quote?symbols=\""
+
+stand_in_require python3 make gcc
+stand_in_portfolio AAPL MSFT
+
+# backend_build NAME BACKEND EDGE_TRIGGERED
+backend_build() {
+	stand_in_copy "$1"
+	stand_in_define "$1" QUOTE_PROVIDER_URL_PREFIX "$URL"
+	stand_in_define "$1" QUOTE_PROVIDER_HEDGE_URL_PREFIX "$URL"
+	stand_in_define "$1" EVENT_FETCH_STOCK_INTERVAL_MS "(300)"
+	stand_in_define "$1" EVENT_LOOP_BACKEND "EVENT_LOOP_BACKEND_$2"
+	stand_in_define "$1" EVENT_LOOP_EPOLL_EDGE_TRIGGERED "($3)"
+	stand_in_build "$1"
+}
+
+backend_build epoll EPOLL 0
+backend_build epoll_edge EPOLL 1
+backend_build io_uring IO_URING 0
+
+stand_in_server python3 "$STAND_IN_ROOT/tests/quote_server.py" "$PORT" \
+	>"$STAND_IN_DIR/server.log" 2>&1
+for name in epoll epoll_edge io_uring; do
+	lines=$(wc -l <"$STAND_IN_DIR/server.log")
+	stand_in_run "$name" 3
+	tail -n +"$((lines + 1))" "$STAND_IN_DIR/server.log" \
+		>"$STAND_IN_DIR/$name/server.log"
+	full=$(grep -c "^200" "$STAND_IN_DIR/$name/server.log")
+	unchanged=$(grep -c "^304" "$STAND_IN_DIR/$name/server.log")
+	echo "$name: $full full responses, $unchanged unchanged"
+	stand_in_expect "$name" "$name displays AAPL" "^AAPL *101.50 (+1.50)"
+	stand_in_expect "$name" "$name displays MSFT" "^MSFT *101.50 (+1.50)"
+	stand_in_check "$name fetched in full once" [ "$full" -eq 1 ]
+	stand_in_check "$name kept polling" [ "$unchanged" -ge 4 ]
+done
+stand_in_done
@@ -0,0 +1,67 @@
+#!/bin/sh
+# Runs teczka with EVENT_IO_CURL_HTTP2_MULTIPLEX against nghttpd serving a canned
+# quote response over TLS with a throwaway self-signed certificate, then checks the
+# quotes made it to the display and that every request went over one connection.
+# Needs nghttpd (from nghttp2) and openssl. H2_SERVER_PORT picks the port.
+
+. "$(dirname "$0")/stand_in.sh"
+
+PORT=${H2_SERVER_PORT:-18443}
+TICKERS=""
+for i in $(seq 1 60); do
+	TICKERS="$TICKERS T$i"
+done
+
+stand_in_require nghttpd openssl make gcc
+mkdir -p "$STAND_IN_DIR/htdocs"
+if ! openssl req -x509 -nodes -newkey rsa:2048 -days 1 -subj /CN=localhost \
+	-addext "subjectAltName=DNS:localhost,IP:127.0.0.1" \
+	-keyout "$STAND_IN_DIR/key.pem" -out "$STAND_IN_DIR/cert.pem" \
+	>/dev/null 2>&1; then
+	echo "couldn't make a certificate"
+	exit 1
+fi
+# nghttpd serves a file so every batch gets every ticker back. teczka only applies
+# the ones it asked for.
+{
+	printf '{"quoteResponse":{"result":['
+	separator=""
+	for ticker in $TICKERS; do
+		printf '%s{"symbol":"%s","regularMarketPrice":101.5,' \
+			"$separator" "$ticker"
+		printf '"regularMarketPreviousClose":100,"regularMarketOpen":100.25}'
+		separator=","
+	done
+	printf '],"error":null}}'
+} >"$STAND_IN_DIR/htdocs/quote"
+stand_in_portfolio $TICKERS
+
+# Small batches fetched often so a short run has plenty of requests in flight at
+# once.
+URL="\"https://localhost:$PORT/quote?symbols=\""
+stand_in_copy h2
+stand_in_define h2 QUOTE_PROVIDER_URL_PREFIX "$URL"
+stand_in_define h2 QUOTE_PROVIDER_HEDGE_URL_PREFIX "$URL"
+stand_in_define h2 QUOTE_PROVIDER_CA_FILE "\"$STAND_IN_DIR/cert.pem\""
+stand_in_define h2 QUOTE_BATCH_SYMBOLS_MAX "(5)"
+stand_in_define h2 EVENT_FETCH_STOCK_INTERVAL_MS "(500)"
+stand_in_define h2 EVENT_IO_CURL_HTTP2_MULTIPLEX "(1)"
+stand_in_build h2
+
+stand_in_server nghttpd -v -d "$STAND_IN_DIR/htdocs" "$PORT" \
+	"$STAND_IN_DIR/key.pem" "$STAND_IN_DIR/cert.pem" \
+	>"$STAND_IN_DIR/nghttpd.log" 2>&1
+stand_in_run h2 6
+
+# nghttpd logs every frame with the id of the connection it was on.
+requests=$(grep -c "recv HEADERS frame" "$STAND_IN_DIR/nghttpd.log")
+connections=$(grep -o "^\[id=[0-9]*\]" "$STAND_IN_DIR/nghttpd.log" | sort -u |
+	wc -l)
+echo "$requests requests over $connections connections"
+stand_in_expect h2 "first ticker displayed" "^T1 *101.50 (+1.50)"
+stand_in_expect h2 "last ticker displayed" "^T60 *101.50 (+1.50)"
+stand_in_check "at least one request per batch per period" \
+	[ "$requests" -ge 60 ]
+stand_in_check "every request multiplexed on one connection" \
+	[ "$connections" -eq 1 ]
+stand_in_done
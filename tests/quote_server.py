@@ -0,0 +1,59 @@
+# Stand-in quote provider for tests/backend_server.sh. Serves the polling API over
+# HTTP/1.1 on the port given as the only argument. Every symbol asked for gets the
+# same canned quote. Responses carry an ETag and a request that sends it back gets
+# a 304, like the provider does while quotes haven't changed. Each request is
+# logged with its status.
+
+import http.server
+import json
+import sys
+import urllib.parse
+
+ETAG = '"quotes-1"'
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def do_HEAD(self):
+        # Connection prewarming.
+        self.send_response(200)
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+
+    def do_GET(self):
+        query = urllib.parse.urlparse(self.path).query
+        symbols = urllib.parse.parse_qs(query).get('symbols', [''])[0]
+        if self.headers.get('If-None-Match') == ETAG:
+            print('304 %s' % symbols, flush=True)
+            self.send_response(304)
+            self.send_header('ETag', ETAG)
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            return
+        print('200 %s' % symbols, flush=True)
+        result = [{
+            'symbol': symbol,
+            'regularMarketPrice': 101.5,
+            'regularMarketPreviousClose': 100,
+            'regularMarketOpen': 100.25,
+        } for symbol in symbols.split(',')]
+        body = json.dumps({
+            'quoteResponse': {
+                'result': result,
+                'error': None
+            }
+        }).encode()
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.send_header('ETag', ETAG)
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, *args):
+        pass
+
+
+http.server.ThreadingHTTPServer(('127.0.0.1', int(sys.argv[1])),
+                                Handler).serve_forever()
@@ -0,0 +1,76 @@
+# Stand-in quote stream for tests/sse_server.sh. Serves Server-Sent Events on the
+# port given as the only argument and logs a line for every stream it opens.
+#
+# The first stream sends a heartbeat, a quote with the fields we skip around it, a
+# broken event and a quote spread over two CRLF data lines, then hangs up. Every
+# stream after that sends new prices and heartbeats until the client leaves. Bytes
+# go out a few at a time so the client sees lines split across reads.
+
+import http.server
+import json
+import sys
+import time
+import urllib.parse
+
+
+def quote(symbol, price):
+    return json.dumps({
+        'symbol': symbol,
+        'regularMarketPrice': price,
+        'regularMarketPreviousClose': 100,
+    })
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    streams = 0
+
+    def do_HEAD(self):
+        # Connection prewarming.
+        self.send_response(200)
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+
+    def do_GET(self):
+        Handler.streams += 1
+        query = urllib.parse.urlparse(self.path).query
+        symbols = urllib.parse.parse_qs(query).get('symbols', [''])[0]
+        print('stream %d for %s' % (Handler.streams, symbols), flush=True)
+        self.send_response(200)
+        self.send_header('Content-Type', 'text/event-stream')
+        self.send_header('Cache-Control', 'no-cache')
+        self.end_headers()
+        # No length so the stream runs until the connection closes.
+        self.close_connection = True
+        try:
+            if 1 == Handler.streams:
+                self._send(': hello\n\n')
+                self._send('id: 1\nevent: quote\ndata: %s\n\n' %
+                           quote('AAPL', 101.5))
+                self._send('data: {"symbol": "BAD\n\n')
+                # Split between two members. The lines are joined with a
+                # newline, which would end up inside a key anywhere else.
+                first, rest = quote('MSFT', 102.5).split(', ', 1)
+                self._send('data: %s,\r\ndata: %s\r\n\r\n' % (first, rest))
+                return
+            self._send('data: %s\n\n' % quote('AAPL', 201.5))
+            self._send('data: %s\r\r' % quote('MSFT', 202.5))
+            while True:
+                time.sleep(0.2)
+                self._send(': heartbeat\n\n')
+        except (BrokenPipeError, ConnectionResetError):
+            pass
+
+    def _send(self, text):
+        data = text.encode()
+        for i in range(0, len(data), 5):
+            self.wfile.write(data[i:i + 5])
+            self.wfile.flush()
+            time.sleep(0.001)
+
+    def log_message(self, *args):
+        pass
+
+
+http.server.ThreadingHTTPServer(('127.0.0.1', int(sys.argv[1])),
+                                Handler).serve_forever()
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Runs teczka with EVENT_QUOTE_STREAM against tests/sse_server.py and checks the
+# pushed quotes are displayed, a broken event doesn't take the rest of the stream
+# with it and the stream is reconnected after the server hangs up. Needs python3.
+# SSE_SERVER_PORT picks the port.
+
+. "$(dirname "$0")/stand_in.sh"
+
+PORT=${SSE_SERVER_PORT:-18080}
+
+stand_in_require python3 make gcc
+stand_in_portfolio AAPL MSFT
+
+stand_in_copy sse
+stand_in_define sse QUOTE_STREAM_URL_PREFIX \
+	"\"http://127.0.0.1:$PORT/quotes/stream?symbols=\""
+stand_in_define sse EVENT_QUOTE_STREAM "(1)"
+stand_in_define sse EVENT_QUOTE_STREAM_RETRY_MS "(500)"
+stand_in_build sse
+
+stand_in_server python3 "$STAND_IN_ROOT/tests/sse_server.py" "$PORT" \
+	>"$STAND_IN_DIR/server.log" 2>&1
+stand_in_run sse 4
+
+streams=$(grep -c "^stream" "$STAND_IN_DIR/server.log")
+echo "$streams streams opened"
+stand_in_expect sse "quote pushed on the first stream" "^AAPL *101.50 (+1.50)"
+stand_in_expect sse "quote after a broken event" "^MSFT *102.50 (+2.50)"
+stand_in_expect sse "quote after reconnecting" "^AAPL *201.50 (+101.50)"
+stand_in_expect sse "quote ended by a bare CR" "^MSFT *202.50 (+102.50)"
+stand_in_check "reconnected once the server hung up" [ "$streams" -ge 2 ]
+stand_in_done
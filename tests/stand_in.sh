@@ -0,0 +1,127 @@
+# Helpers for the scripts that run teczka against a stand-in quote server on
+# localhost. Source it from a script in tests/. Every run builds its own copy of the
+# tree in a temporary directory with config.h pointed at the stand-in, so the tree
+# and its config.h are never touched.
+
+STAND_IN_ROOT=$(cd "$(dirname "$0")/.." && pwd)
+STAND_IN_DIR=$(mktemp -d)
+STAND_IN_PIDS=""
+STAND_IN_FAILED=0
+trap 'stand_in_cleanup' EXIT
+trap 'exit 1' INT TERM
+
+stand_in_cleanup() {
+	for pid in $STAND_IN_PIDS; do
+		kill "$pid" 2>/dev/null
+	done
+	rm -rf "$STAND_IN_DIR"
+}
+
+# stand_in_require COMMAND...: exits if a command the script needs isn't installed.
+stand_in_require() {
+	for command in "$@"; do
+		if ! command -v "$command" >/dev/null 2>&1; then
+			echo "$(basename "$0"): needs $command"
+			exit 1
+		fi
+	done
+}
+
+# stand_in_server COMMAND...: starts a server in the background and remembers it
+# so it's stopped on exit. Give it a moment to listen. Exits if it died, usually
+# because something else has the port.
+stand_in_server() {
+	"$@" &
+	pid=$!
+	STAND_IN_PIDS="$STAND_IN_PIDS $pid"
+	sleep 1
+	if ! kill -0 "$pid" 2>/dev/null; then
+		echo "$1 didn't start"
+		exit 1
+	fi
+}
+
+# stand_in_portfolio TICKER...: writes a Fidelity CSV holding 10 of each ticker to
+# $STAND_IN_DIR/portfolio.csv.
+stand_in_portfolio() {
+	csv="$STAND_IN_DIR/portfolio.csv"
+	echo "Account Number,Account Name,Symbol,Description,Quantity,Last Price,Last Price Change,Current Value,Today's Gain/Loss Dollar,Today's Gain/Loss Percent,Total Gain/Loss Dollar,Total Gain/Loss Percent,Percent Of Account,Cost Basis Total,Average Cost Basis,Type" >"$csv"
+	for ticker in "$@"; do
+		echo "X1,Ind,$ticker,$ticker,10,\$100.00,+\$1.00,\$1000.00,+\$10.00,+1.00%,+\$0,+0%,1%,\$1000.00,\$100.00,Cash" >>"$csv"
+	done
+}
+
+# stand_in_copy NAME: copies the sources to $STAND_IN_DIR/NAME.
+stand_in_copy() {
+	mkdir -p "$STAND_IN_DIR/$1"
+	cp "$STAND_IN_ROOT"/*.c "$STAND_IN_ROOT"/*.h "$STAND_IN_ROOT"/Makefile \
+		"$STAND_IN_DIR/$1"
+}
+
+# stand_in_define NAME MACRO VALUE: replaces the #define of MACRO in NAME's
+# config.h, commented out or spread over several lines included.
+stand_in_define() {
+	config="$STAND_IN_DIR/$1/config.h"
+	sed -i "/^\(\/\/ \)\?#define $2\( \|\$\)/{
+:more
+/\\\\\$/{
+N
+b more
+}
+s|.*|#define $2 $3|
+}" "$config"
+	if ! grep -qxF "#define $2 $3" "$config"; then
+		echo "config.h has no $2 to set"
+		exit 1
+	fi
+}
+
+# stand_in_build NAME: builds the copy. Exits with the build output if it fails.
+stand_in_build() {
+	if ! make -C "$STAND_IN_DIR/$1" >"$STAND_IN_DIR/$1/build.log" 2>&1; then
+		cat "$STAND_IN_DIR/$1/build.log"
+		exit 1
+	fi
+}
+
+# stand_in_run NAME SECONDS: runs the copy on the portfolio for SECONDS. Its output
+# goes to $STAND_IN_DIR/NAME/out.
+stand_in_run() {
+	(cd "$STAND_IN_DIR/$1" &&
+		timeout "$2" stdbuf -o0 ./bin/teczka \
+			"$STAND_IN_DIR/portfolio.csv" >out 2>&1)
+}
+
+# stand_in_expect NAME DESCRIPTION PATTERN: passes if PATTERN is in NAME's output.
+stand_in_expect() {
+	if grep -q -- "$3" "$STAND_IN_DIR/$1/out"; then
+		echo "ok: $2"
+	else
+		echo "FAILED: $2"
+		STAND_IN_FAILED=1
+	fi
+}
+
+# stand_in_check DESCRIPTION COMMAND...: passes if COMMAND succeeds.
+stand_in_check() {
+	description=$1
+	shift
+	if "$@"; then
+		echo "ok: $description"
+	else
+		echo "FAILED: $description"
+		STAND_IN_FAILED=1
+	fi
+}
+
+# stand_in_done: prints the output of every run if anything failed and exits with
+# the result.
+stand_in_done() {
+	if [ 0 != "$STAND_IN_FAILED" ]; then
+		for out in "$STAND_IN_DIR"/*/out; do
+			echo "--- $out"
+			tail -n 40 "$out"
+		done
+	fi
+	exit "$STAND_IN_FAILED"
+}
@@ -0,0 +1,26 @@
+#ifndef _TECZKA_TEST_H
+#define _TECZKA_TEST_H
+
+#include <stdio.h>
+
+// Every test is a static int function that returns 0 when it passes. TEST_CHECK
+// prints where it failed and returns 1 from the test.
+#define TEST_CHECK(cond)                                                    \
+	do {                                                                \
+		if (!(cond)) {                                              \
+			printf("%s:%d: check failed: %s\n", __FILE__,      \
+			       __LINE__, #cond);                            \
+			return 1;                                           \
+		}                                                           \
+	} while (0)
+
+// Runs test and counts it in failed if it didn't pass.
+#define TEST_RUN(test, failed)                                              \
+	do {                                                                \
+		if (0 != test()) {                                          \
+			printf("%s failed\n", #test);                       \
+			++(failed);                                         \
+		}                                                           \
+	} while (0)
+
+#endif // _TECZKA_TEST_H
@@ -0,0 +1,278 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "equity.h"
+#include "event.h"
+#include "portfolio.h"
+#include "test.h"
+#include "util.h"
+
+// Well past MEM_CACHE_EVENT_NODE_COUNT so the heap has to grow.
+#define NODES_LEN (4096)
+#define RANDOM_ROUNDS (200000)
+
+static int _test_order(void);
+static int _test_priority(void);
+static int _test_pending(void);
+static int _test_random(void);
+// The wheel starts its clock at timestamp_ms_get() and treats anything before it
+// as already expired, so every test schedules relative to the real time.
+static uint64_t _now_ms_get(void);
+// Sets up node i as an event for equities[i] with the given tag and run time.
+static void _node_set(size_t i, enum event_tag tag, uint64_t run_timestamp_ms);
+// The time the queue should order a node by. See _event_node_key in event.c.
+static uint64_t _node_key(const struct event_node *node);
+// Small deterministic generator so runs are repeatable.
+static uint64_t _random_next(void);
+
+static struct event_queue queue;
+static struct event_node nodes[NODES_LEN];
+static int queued[NODES_LEN];
+// Targets for the nodes' events. Every node gets its own so each one is indexed.
+static struct equity equities[NODES_LEN];
+static struct portfolio portfolios[NODES_LEN];
+static uint64_t random_state = 0x9e3779b97f4a7c15ULL;
+
+int main(void)
+{
+	int failed = 0;
+	TEST_RUN(_test_order, failed);
+	TEST_RUN(_test_priority, failed);
+	TEST_RUN(_test_pending, failed);
+	TEST_RUN(_test_random, failed);
+#if EVENT_QUEUE_BACKEND == EVENT_QUEUE_BACKEND_WHEEL
+	printf("test_event_queue (wheel): %s\n", 0 == failed ? "ok" : "FAILED");
+#else
+	printf("test_event_queue (heap): %s\n", 0 == failed ? "ok" : "FAILED");
+#endif
+	return 0 != failed;
+}
+
+static int _test_order(void)
+{
+	TEST_CHECK(0 == event_queue_init(&queue));
+	const uint64_t now_ms = _now_ms_get();
+	for (size_t i = 0; i < NODES_LEN; ++i) {
+		_node_set(i, TECZKA_EVENT_FETCH_STOCK,
+			  now_ms + _random_next() % 100);
+		TEST_CHECK(0 == event_queue_add(&queue, &nodes[i]));
+	}
+	event_queue_advance(&queue, now_ms + 100);
+	const struct event_node *prev = NULL;
+	for (size_t i = 0; i < NODES_LEN; ++i) {
+		const struct event_node *node = event_queue_dequeue(&queue);
+		TEST_CHECK(NULL != node);
+		if (NULL != prev) {
+			TEST_CHECK(_node_key(prev) <= _node_key(node));
+#if EVENT_QUEUE_BACKEND == EVENT_QUEUE_BACKEND_HEAP
+			// The heap keeps events due at the same time in FIFO order.
+			TEST_CHECK(_node_key(prev) != _node_key(node) ||
+				   prev < node);
+#endif
+		}
+		prev = node;
+	}
+	TEST_CHECK(NULL == event_queue_dequeue(&queue));
+	TEST_CHECK(NULL == event_queue_peek(&queue));
+	return 0;
+}
+
+static int _test_priority(void)
+{
+	TEST_CHECK(0 == event_queue_init(&queue));
+	const uint64_t now_ms = _now_ms_get();
+	// A redraw only runs before a fetch due a little after it if it's due more
+	// than the slack for two classes earlier.
+	_node_set(0, TECZKA_EVENT_FETCH_STOCK, now_ms + 100);
+	_node_set(1, TECZKA_EVENT_DISPLAY_STOCK,
+		  now_ms + 100 - 2 * EVENT_PRIORITY_SLACK_MS + 1);
+	_node_set(2, TECZKA_EVENT_DISPLAY_STOCK,
+		  now_ms + 100 - 2 * EVENT_PRIORITY_SLACK_MS - 1);
+	for (size_t i = 0; i < 3; ++i) {
+		TEST_CHECK(0 == event_queue_add(&queue, &nodes[i]));
+	}
+	event_queue_advance(&queue, now_ms + 200);
+	TEST_CHECK(&nodes[2] == event_queue_dequeue(&queue));
+	TEST_CHECK(&nodes[0] == event_queue_dequeue(&queue));
+	TEST_CHECK(&nodes[1] == event_queue_dequeue(&queue));
+	TEST_CHECK(NULL == event_queue_dequeue(&queue));
+	return 0;
+}
+
+static int _test_pending(void)
+{
+	TEST_CHECK(0 == event_queue_init(&queue));
+	const uint64_t now_ms = _now_ms_get();
+	_node_set(0, TECZKA_EVENT_FETCH_STOCK, now_ms + 50);
+	_node_set(1, TECZKA_EVENT_DISPLAY_STOCK, now_ms + 10);
+	TEST_CHECK(0 == event_queue_add(&queue, &nodes[0]));
+	TEST_CHECK(0 == event_queue_add(&queue, &nodes[1]));
+	TEST_CHECK(&nodes[0] == event_queue_pending_get(&queue,
+							TECZKA_EVENT_FETCH_STOCK,
+							&equities[0]));
+	// Same target but another tag.
+	TEST_CHECK(NULL == event_queue_pending_get(&queue,
+						   TECZKA_EVENT_DISPLAY_STOCK,
+						   &equities[0]));
+	// A second node for the same work doesn't replace the pending one.
+	nodes[2] = nodes[0];
+	TEST_CHECK(0 == event_queue_add(&queue, &nodes[2]));
+	TEST_CHECK(&nodes[0] == event_queue_pending_get(&queue,
+							TECZKA_EVENT_FETCH_STOCK,
+							&equities[0]));
+	TEST_CHECK(0 == event_queue_remove(&queue, &nodes[2]));
+	// Rescheduling keeps the node indexed and reorders it.
+	TEST_CHECK(0 == event_queue_reschedule(&queue, &nodes[0], now_ms + 1));
+	TEST_CHECK(&nodes[0] == event_queue_pending_get(&queue,
+							TECZKA_EVENT_FETCH_STOCK,
+							&equities[0]));
+	event_queue_advance(&queue, now_ms + 100);
+	TEST_CHECK(&nodes[0] == event_queue_dequeue(&queue));
+	TEST_CHECK(NULL == event_queue_pending_get(&queue,
+						   TECZKA_EVENT_FETCH_STOCK,
+						   &equities[0]));
+	TEST_CHECK(0 == event_queue_remove(&queue, &nodes[1]));
+	TEST_CHECK(NULL == event_queue_pending_get(&queue,
+						   TECZKA_EVENT_DISPLAY_STOCK,
+						   &equities[1]));
+	TEST_CHECK(NULL == event_queue_dequeue(&queue));
+	TEST_CHECK(0 != event_queue_add(NULL, &nodes[0]));
+	TEST_CHECK(0 != event_queue_add(&queue, NULL));
+	return 0;
+}
+
+static int _test_random(void)
+{
+	static const enum event_tag TAGS[] = {
+		TECZKA_EVENT_FETCH_STOCK,
+		TECZKA_EVENT_PORTFOLIO_IMPORTED,
+		TECZKA_EVENT_DISPLAY_STOCK,
+	};
+	TEST_CHECK(0 == event_queue_init(&queue));
+	for (size_t i = 0; i < NODES_LEN; ++i) {
+		queued[i] = 0;
+	}
+	uint64_t now_ms = _now_ms_get();
+	event_queue_advance(&queue, now_ms);
+	for (size_t round = 0; round < RANDOM_ROUNDS; ++round) {
+		const uint64_t op = _random_next() % 10;
+		const size_t i = _random_next() % NODES_LEN;
+		if (op < 4 && !queued[i]) {
+			// Mostly near events with some far enough out to land in the
+			// wheel's upper levels or its overflow list, and a few already
+			// late.
+			const uint64_t spans[] = { 70, 5000, 20000000, 1ULL << 36 };
+			uint64_t run_timestamp_ms =
+				now_ms + _random_next() % spans[_random_next() % 4];
+			if (0 == _random_next() % 3) {
+				run_timestamp_ms -= _random_next() % 30;
+			}
+			_node_set(i, TAGS[_random_next() % 3], run_timestamp_ms);
+			TEST_CHECK(0 == event_queue_add(&queue, &nodes[i]));
+			queued[i] = 1;
+		} else if (op < 5 && queued[i]) {
+			TEST_CHECK(0 == event_queue_remove(&queue, &nodes[i]));
+			queued[i] = 0;
+		} else if (op < 6 && queued[i]) {
+			TEST_CHECK(0 == event_queue_reschedule(
+						&queue, &nodes[i],
+						now_ms + _random_next() % 5000));
+		} else if (op < 8) {
+			now_ms += _random_next() % 3000;
+			struct event_node *due[EVENT_LOOP_DUE_BATCH_LEN];
+			size_t due_len;
+			do {
+				due_len = event_queue_dequeue_due(
+					&queue, now_ms, due,
+					EVENT_LOOP_DUE_BATCH_LEN);
+				for (size_t j = 0; j < due_len; ++j) {
+					TEST_CHECK(due[j]->event.run_timestamp_ms <=
+						   now_ms);
+#if EVENT_QUEUE_BACKEND == EVENT_QUEUE_BACKEND_HEAP
+					// The wheel hands out nodes that were late when
+					// they were added in FIFO order instead.
+					TEST_CHECK(0 == j ||
+						   _node_key(due[j - 1]) <=
+							   _node_key(due[j]));
+#endif
+					queued[due[j] - nodes] = 0;
+				}
+			} while (EVENT_LOOP_DUE_BATCH_LEN == due_len);
+			// The first node left has the lowest key of what's queued and
+			// isn't due.
+			const struct event_node *first = event_queue_peek(&queue);
+			uint64_t key_min = UINT64_MAX;
+			for (size_t j = 0; j < NODES_LEN; ++j) {
+				if (queued[j] && _node_key(&nodes[j]) < key_min) {
+					key_min = _node_key(&nodes[j]);
+				}
+			}
+			TEST_CHECK((NULL == first ? UINT64_MAX : _node_key(first)) ==
+				   key_min);
+			TEST_CHECK(NULL == first ||
+				   first->event.run_timestamp_ms > now_ms);
+		} else if (0 == _random_next() % 50) {
+			// Every so often jump far ahead like after a suspend.
+			now_ms += _random_next() % 100000000;
+			event_queue_advance(&queue, now_ms);
+		}
+	}
+	for (size_t i = 0; i < NODES_LEN; ++i) {
+		if (queued[i]) {
+			TEST_CHECK(&nodes[i] ==
+				   event_queue_pending_get(
+					   &queue, nodes[i].event.tag,
+					   event_target_get(&nodes[i].event)));
+		}
+	}
+	return 0;
+}
+
+static void _node_set(size_t i, enum event_tag tag, uint64_t run_timestamp_ms)
+{
+	nodes[i].event = (struct event){
+		.tag = tag,
+		.run_timestamp_ms = run_timestamp_ms,
+	};
+	switch (tag) {
+	case TECZKA_EVENT_FETCH_STOCK:
+		nodes[i].event.stock_fetch_info.stock = &equities[i];
+		break;
+	case TECZKA_EVENT_DISPLAY_STOCK:
+		nodes[i].event.stock_display_info.stock = &equities[i];
+		break;
+	case TECZKA_EVENT_PORTFOLIO_IMPORTED:
+		nodes[i].event.portfolio_imported_info.portfolio = &portfolios[i];
+		break;
+	case TECZKA_EVENT_FETCH_HEDGE:
+	case TECZKA_EVENT_STREAM_CONNECT:
+	case TECZKA_EVENT_DISPLAY_PORTFOLIO:
+	case TECZKA_EVENT_CURL_TIMEOUT:
+	default:
+		break;
+	}
+}
+
+static uint64_t _node_key(const struct event_node *node)
+{
+	return node->event.run_timestamp_ms +
+	       (uint64_t)event_priority_get(&node->event) *
+		       EVENT_PRIORITY_SLACK_MS;
+}
+
+static uint64_t _now_ms_get(void)
+{
+	// A little ahead so nothing added right after init is late.
+	return timestamp_ms_get() + 1000;
+}
+
+static uint64_t _random_next(void)
+{
+	// xorshift64
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return random_state;
+}
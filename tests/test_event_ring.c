@@ -0,0 +1,110 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "event_ring.h"
+#include "test.h"
+
+#define PRODUCERS (4)
+#define PRODUCER_EVENTS (5000)
+
+static int _test_order(void);
+static int _test_full_empty(void);
+static int _test_producers(void);
+// Pushes PRODUCER_EVENTS events tagged with the producer's id, retrying while the
+// ring is full.
+static void *_producer_run(void *id_ptr);
+
+static struct event_ring ring;
+
+int main(void)
+{
+	int failed = 0;
+	TEST_RUN(_test_order, failed);
+	TEST_RUN(_test_full_empty, failed);
+	TEST_RUN(_test_producers, failed);
+	printf("test_event_ring: %s\n", 0 == failed ? "ok" : "FAILED");
+	return 0 != failed;
+}
+
+static int _test_order(void)
+{
+	TEST_CHECK(0 == event_ring_init(&ring));
+	struct event event = { 0 };
+	TEST_CHECK(0 != event_ring_pop(&ring, &event));
+	// Go around the ring a few times so the indices wrap.
+	for (uint64_t i = 0; i < 3 * EVENT_RING_CAPACITY; ++i) {
+		event.run_timestamp_ms = i;
+		TEST_CHECK(0 == event_ring_push(&ring, &event));
+		TEST_CHECK(0 == event_ring_pop(&ring, &event));
+		TEST_CHECK(i == event.run_timestamp_ms);
+	}
+	TEST_CHECK(0 != event_ring_pop(&ring, &event));
+	return 0;
+}
+
+static int _test_full_empty(void)
+{
+	TEST_CHECK(0 == event_ring_init(&ring));
+	struct event event = { 0 };
+	for (uint64_t i = 0; i < EVENT_RING_CAPACITY; ++i) {
+		event.run_timestamp_ms = i;
+		TEST_CHECK(0 == event_ring_push(&ring, &event));
+	}
+	TEST_CHECK(0 != event_ring_push(&ring, &event));
+	for (uint64_t i = 0; i < EVENT_RING_CAPACITY; ++i) {
+		TEST_CHECK(0 == event_ring_pop(&ring, &event));
+		TEST_CHECK(i == event.run_timestamp_ms);
+	}
+	TEST_CHECK(0 != event_ring_pop(&ring, &event));
+	TEST_CHECK(0 != event_ring_push(NULL, &event));
+	TEST_CHECK(0 != event_ring_push(&ring, NULL));
+	TEST_CHECK(0 != event_ring_pop(&ring, NULL));
+	TEST_CHECK(0 != event_ring_init(NULL));
+	return 0;
+}
+
+static int _test_producers(void)
+{
+	TEST_CHECK(0 == event_ring_init(&ring));
+	pthread_t producers[PRODUCERS];
+	for (uintptr_t i = 0; i < PRODUCERS; ++i) {
+		TEST_CHECK(0 == pthread_create(&producers[i], NULL,
+					       _producer_run, (void *)i));
+	}
+	// Every producer's events have to come out in the order it pushed them and
+	// none can be lost or duplicated.
+	uint64_t next[PRODUCERS] = { 0 };
+	size_t popped = 0;
+	while (popped < PRODUCERS * PRODUCER_EVENTS) {
+		struct event event;
+		if (0 != event_ring_pop(&ring, &event)) {
+			continue;
+		}
+		const uint64_t id = event.run_timestamp_ms >> 32;
+		const uint64_t sequence = event.run_timestamp_ms & UINT32_MAX;
+		TEST_CHECK(id < PRODUCERS);
+		TEST_CHECK(next[id] == sequence);
+		++next[id];
+		++popped;
+	}
+	for (size_t i = 0; i < PRODUCERS; ++i) {
+		TEST_CHECK(0 == pthread_join(producers[i], NULL));
+	}
+	struct event event;
+	TEST_CHECK(0 != event_ring_pop(&ring, &event));
+	return 0;
+}
+
+static void *_producer_run(void *id_ptr)
+{
+	const uint64_t id = (uint64_t)(uintptr_t)id_ptr;
+	struct event event = { 0 };
+	for (uint64_t i = 0; i < PRODUCER_EVENTS;) {
+		event.run_timestamp_ms = id << 32 | i;
+		if (0 == event_ring_push(&ring, &event)) {
+			++i;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,185 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "quote_scan.h"
+#include "test.h"
+
+#define RECORDS_MAX (8)
+
+struct records {
+	struct quote_record records[RECORDS_MAX];
+	size_t len;
+};
+
+static void _record_keep(const struct quote_record *record, void *context);
+// Scans response in three chunks split at first and second.
+static enum quote_scan_error _scan_split(struct records *records,
+					 const char *response, size_t first,
+					 size_t second);
+static int _records_equal(const struct records *a, const struct records *b);
+
+static int _test_fields(void);
+static int _test_rejected_values(void);
+static int _test_chunk_splits(void);
+static int _test_too_deep(void);
+static int _test_null_args(void);
+
+// Yahoo style response with the things the scanner has to step around: keys we
+// don't want, a nested object with a key we do want, escaped quotes and
+// backslashes in keys and strings, and arrays inside a quote.
+static const char RESPONSE[] =
+	"{\"quoteResponse\":{\"result\":[{\"language\":\"en-US\","
+	"\"regularMarketOpen\":150.519,\"quoteType\":\"EQUITY\","
+	"\"nested\":{\"regularMarketPrice\":9},"
+	"\"regularMarketPrice\" : 151.2599,\"symb\\\"ol\":\"X\","
+	"\"regularMarketPreviousClose\":150,\"arr\":[1,{\"a\":\"b\\\\\"}],"
+	"\"symbol\":\"AAPL\"},"
+	"{\"symbol\":\"BRK-B\",\"regularMarketPrice\":4.1e2,"
+	"\"regularMarketPreviousClose\":-0.05,\"regularMarketOpen\":null},"
+	"{\"symbol\":\"TOOLONGSYM\",\"regularMarketPrice\":\"$1,234.5\"}],"
+	"\"error\":null}}";
+
+int main(void)
+{
+	int failed = 0;
+	TEST_RUN(_test_fields, failed);
+	TEST_RUN(_test_rejected_values, failed);
+	TEST_RUN(_test_chunk_splits, failed);
+	TEST_RUN(_test_too_deep, failed);
+	TEST_RUN(_test_null_args, failed);
+	printf("test_quote_scan: %s\n", 0 == failed ? "ok" : "FAILED");
+	return 0 != failed;
+}
+
+static void _record_keep(const struct quote_record *record, void *context)
+{
+	struct records *records = (struct records *)context;
+	if (records->len < RECORDS_MAX) {
+		records->records[records->len++] = *record;
+	}
+}
+
+static enum quote_scan_error _scan_split(struct records *records,
+					 const char *response, size_t first,
+					 size_t second)
+{
+	const size_t len = strlen(response);
+	struct quote_scan scan;
+	records->len = 0;
+	quote_scan_init(&scan, _record_keep, records);
+	(void)quote_scan_feed(&scan, response, first);
+	(void)quote_scan_feed(&scan, response + first, second - first);
+	return quote_scan_feed(&scan, response + second, len - second);
+}
+
+static int _records_equal(const struct records *a, const struct records *b)
+{
+	if (a->len != b->len) {
+		return 0;
+	}
+	for (size_t i = 0; i < a->len; ++i) {
+		const struct quote_record *x = &a->records[i];
+		const struct quote_record *y = &b->records[i];
+		if (x->fields != y->fields ||
+		    x->price_cents_current != y->price_cents_current ||
+		    x->price_cents_close_previous !=
+			    y->price_cents_close_previous ||
+		    x->price_cents_open != y->price_cents_open ||
+		    ((x->fields & QUOTE_FIELD_SYMBOL) &&
+		     0 != strcmp(x->symbol, y->symbol))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int _test_fields(void)
+{
+	struct records records;
+	TEST_CHECK(QUOTE_SCAN_ERROR_OK ==
+		   _scan_split(&records, RESPONSE, 0, 0));
+	TEST_CHECK(3 == records.len);
+	const struct quote_record *aapl = &records.records[0];
+	TEST_CHECK((QUOTE_FIELD_SYMBOL | QUOTE_FIELD_PRICE |
+		    QUOTE_FIELD_CLOSE_PREVIOUS | QUOTE_FIELD_OPEN) ==
+		   aapl->fields);
+	TEST_CHECK(0 == strcmp("AAPL", aapl->symbol));
+	// Digits past the hundredths place are truncated and the nested
+	// regularMarketPrice doesn't count.
+	TEST_CHECK(15125 == aapl->price_cents_current);
+	TEST_CHECK(15000 == aapl->price_cents_close_previous);
+	TEST_CHECK(15051 == aapl->price_cents_open);
+	return 0;
+}
+
+static int _test_rejected_values(void)
+{
+	struct records records;
+	TEST_CHECK(QUOTE_SCAN_ERROR_OK ==
+		   _scan_split(&records, RESPONSE, 0, 0));
+	TEST_CHECK(3 == records.len);
+	// An exponent and null are thrown out. A negative value is kept.
+	const struct quote_record *brk = &records.records[1];
+	TEST_CHECK((QUOTE_FIELD_SYMBOL | QUOTE_FIELD_CLOSE_PREVIOUS) ==
+		   brk->fields);
+	TEST_CHECK(0 == strcmp("BRK-B", brk->symbol));
+	TEST_CHECK(-5 == brk->price_cents_close_previous);
+	// A symbol longer than EQUITY_KEY_BYTES_MAX is dropped. A quoted price has
+	// everything but digits and the decimal point ignored.
+	const struct quote_record *too_long = &records.records[2];
+	TEST_CHECK(QUOTE_FIELD_PRICE == too_long->fields);
+	TEST_CHECK(123450 == too_long->price_cents_current);
+	return 0;
+}
+
+static int _test_chunk_splits(void)
+{
+	struct records whole;
+	struct records split;
+	TEST_CHECK(QUOTE_SCAN_ERROR_OK == _scan_split(&whole, RESPONSE, 0, 0));
+	const size_t len = strlen(RESPONSE);
+	for (size_t first = 0; first <= len; ++first) {
+		for (size_t second = first; second <= len; second += 7) {
+			TEST_CHECK(QUOTE_SCAN_ERROR_OK ==
+				   _scan_split(&split, RESPONSE, first,
+					       second));
+			TEST_CHECK(_records_equal(&whole, &split));
+		}
+	}
+	return 0;
+}
+
+static int _test_too_deep(void)
+{
+	char response[80];
+	(void)memset(response, '[', sizeof(response) - 1);
+	response[sizeof(response) - 1] = '\0';
+	struct records records;
+	TEST_CHECK(QUOTE_SCAN_ERROR_TOO_DEEP ==
+		   _scan_split(&records, response, 0, 0));
+	// The error sticks until the scan is reset.
+	struct quote_scan scan;
+	quote_scan_init(&scan, _record_keep, &records);
+	TEST_CHECK(QUOTE_SCAN_ERROR_TOO_DEEP ==
+		   quote_scan_feed(&scan, response, strlen(response)));
+	TEST_CHECK(QUOTE_SCAN_ERROR_TOO_DEEP == quote_scan_feed(&scan, "]", 1));
+	quote_scan_init(&scan, _record_keep, &records);
+	records.len = 0;
+	TEST_CHECK(QUOTE_SCAN_ERROR_OK ==
+		   quote_scan_feed(&scan, RESPONSE, strlen(RESPONSE)));
+	TEST_CHECK(3 == records.len);
+	return 0;
+}
+
+static int _test_null_args(void)
+{
+	struct records records = { .len = 0 };
+	struct quote_scan scan;
+	quote_scan_init(&scan, _record_keep, &records);
+	TEST_CHECK(QUOTE_SCAN_ERROR_NULL_ARG == quote_scan_feed(NULL, "{}", 2));
+	TEST_CHECK(QUOTE_SCAN_ERROR_NULL_ARG == quote_scan_feed(&scan, NULL, 2));
+	quote_scan_init(&scan, _record_keep, &records);
+	TEST_CHECK(QUOTE_SCAN_ERROR_OK == quote_scan_feed(&scan, NULL, 0));
+	return 0;
+}
@@ -0,0 +1,167 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "quote_scan.h"
+#include "sse_scan.h"
+#include "test.h"
+
+#define RECORDS_MAX (8)
+
+struct records {
+	struct quote_record records[RECORDS_MAX];
+	size_t len;
+};
+
+static void _record_keep(const struct quote_record *record, void *context);
+// Scans stream in chunks of at most chunk_len bytes. 0 feeds it whole.
+static enum sse_scan_error _scan_chunks(struct records *records,
+					const char *stream, size_t chunk_len);
+static int _records_equal(const struct records *a, const struct records *b);
+
+static int _test_events(void);
+static int _test_bad_events(void);
+static int _test_chunk_splits(void);
+static int _test_null_args(void);
+
+// A stream with the things the scanner has to handle: LF, CRLF and bare CR line
+// ends, a heartbeat comment, fields we skip, a field that only starts like data and
+// an event whose JSON is spread over two data lines.
+static const char STREAM[] =
+	": heartbeat\n\n"
+	"id: 1\nevent: quote\nretry: 500\n"
+	"data: {\"symbol\":\"AAPL\",\"regularMarketPrice\":101.5}\n\n"
+	"datas: {\"symbol\":\"NOPE\"}\r\n\r\n"
+	"data:{\"symbol\":\"MSFT\",\r\n"
+	"data: \"regularMarketPreviousClose\":99}\r\n\r\n"
+	"data: {\"symbol\":\"T\",\"regularMarketOpen\":7}\r\r";
+
+int main(void)
+{
+	int failed = 0;
+	TEST_RUN(_test_events, failed);
+	TEST_RUN(_test_bad_events, failed);
+	TEST_RUN(_test_chunk_splits, failed);
+	TEST_RUN(_test_null_args, failed);
+	printf("test_sse_scan: %s\n", 0 == failed ? "ok" : "FAILED");
+	return 0 != failed;
+}
+
+static void _record_keep(const struct quote_record *record, void *context)
+{
+	struct records *records = (struct records *)context;
+	if (records->len < RECORDS_MAX) {
+		records->records[records->len++] = *record;
+	}
+}
+
+static enum sse_scan_error _scan_chunks(struct records *records,
+					const char *stream, size_t chunk_len)
+{
+	const size_t len = strlen(stream);
+	if (0 == chunk_len) {
+		chunk_len = len;
+	}
+	struct quote_scan quote_scan;
+	struct sse_scan scan;
+	records->len = 0;
+	quote_scan_init(&quote_scan, _record_keep, records);
+	sse_scan_init(&scan, &quote_scan);
+	for (size_t i = 0; i < len; i += chunk_len) {
+		const size_t left = len - i;
+		const enum sse_scan_error error = sse_scan_feed(
+			&scan, stream + i, left < chunk_len ? left : chunk_len);
+		if (SSE_SCAN_ERROR_OK != error) {
+			return error;
+		}
+	}
+	return SSE_SCAN_ERROR_OK;
+}
+
+static int _records_equal(const struct records *a, const struct records *b)
+{
+	if (a->len != b->len) {
+		return 0;
+	}
+	for (size_t i = 0; i < a->len; ++i) {
+		const struct quote_record *x = &a->records[i];
+		const struct quote_record *y = &b->records[i];
+		if (x->fields != y->fields ||
+		    x->price_cents_current != y->price_cents_current ||
+		    x->price_cents_close_previous !=
+			    y->price_cents_close_previous ||
+		    x->price_cents_open != y->price_cents_open ||
+		    ((x->fields & QUOTE_FIELD_SYMBOL) &&
+		     0 != strcmp(x->symbol, y->symbol))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int _test_events(void)
+{
+	struct records records;
+	TEST_CHECK(SSE_SCAN_ERROR_OK == _scan_chunks(&records, STREAM, 0));
+	TEST_CHECK(3 == records.len);
+	TEST_CHECK(0 == strcmp("AAPL", records.records[0].symbol));
+	TEST_CHECK((QUOTE_FIELD_SYMBOL | QUOTE_FIELD_PRICE) ==
+		   records.records[0].fields);
+	TEST_CHECK(10150 == records.records[0].price_cents_current);
+	// The two data lines are joined with a newline, which JSON treats as space.
+	TEST_CHECK(0 == strcmp("MSFT", records.records[1].symbol));
+	TEST_CHECK((QUOTE_FIELD_SYMBOL | QUOTE_FIELD_CLOSE_PREVIOUS) ==
+		   records.records[1].fields);
+	TEST_CHECK(9900 == records.records[1].price_cents_close_previous);
+	TEST_CHECK(0 == strcmp("T", records.records[2].symbol));
+	TEST_CHECK(700 == records.records[2].price_cents_open);
+	return 0;
+}
+
+static int _test_bad_events(void)
+{
+	// An event cut off in the middle of a string and one nested too deep only
+	// lose themselves. The events after them still come through.
+	char stream[256] = "data: {\"symbol\": \"BAD\n\ndata: ";
+	const size_t start = strlen(stream);
+	(void)memset(stream + start, '[', 80);
+	(void)strcpy(stream + start + 80,
+		     "\n\ndata: {\"symbol\":\"OK\",\"regularMarketPrice\":2}\n\n");
+	struct records records;
+	TEST_CHECK(SSE_SCAN_ERROR_OK == _scan_chunks(&records, stream, 0));
+	TEST_CHECK(1 == records.len);
+	TEST_CHECK(0 == strcmp("OK", records.records[0].symbol));
+	TEST_CHECK(200 == records.records[0].price_cents_current);
+	return 0;
+}
+
+static int _test_chunk_splits(void)
+{
+	struct records whole;
+	struct records split;
+	TEST_CHECK(SSE_SCAN_ERROR_OK == _scan_chunks(&whole, STREAM, 0));
+	const size_t len = strlen(STREAM);
+	// Every chunk size splits the stream at a different set of places, CRLF pairs
+	// included.
+	for (size_t chunk_len = 1; chunk_len <= len; ++chunk_len) {
+		TEST_CHECK(SSE_SCAN_ERROR_OK ==
+			   _scan_chunks(&split, STREAM, chunk_len));
+		TEST_CHECK(_records_equal(&whole, &split));
+	}
+	return 0;
+}
+
+static int _test_null_args(void)
+{
+	struct records records = { .len = 0 };
+	struct quote_scan quote_scan;
+	struct sse_scan scan;
+	quote_scan_init(&quote_scan, _record_keep, &records);
+	sse_scan_init(&scan, NULL);
+	TEST_CHECK(SSE_SCAN_ERROR_NULL_ARG == sse_scan_feed(&scan, "\n", 1));
+	sse_scan_init(&scan, &quote_scan);
+	TEST_CHECK(SSE_SCAN_ERROR_NULL_ARG == sse_scan_feed(NULL, "\n", 1));
+	TEST_CHECK(SSE_SCAN_ERROR_NULL_ARG == sse_scan_feed(&scan, NULL, 1));
+	TEST_CHECK(SSE_SCAN_ERROR_OK == sse_scan_feed(&scan, NULL, 0));
+	return 0;
+}
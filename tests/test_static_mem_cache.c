@@ -0,0 +1,188 @@
+// For MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "static_mem_cache.h"
+#include "test.h"
+
+#define BUFFER_LEN (100)
+// Enough to need a few dozen slabs past the buffer.
+#define GROWN_LEN (5000)
+
+struct element {
+	char bytes[40];
+};
+
+static int _test_init_errors(void);
+static int _test_fixed(void);
+static int _test_growable(void);
+static int _test_stray_pointers(void);
+// Sets up cache over its own buffer, checking double frees and growing.
+static int _cache_init(struct static_mem_cache *cache, struct element *buffer,
+		       uint64_t *bitmap);
+
+static struct element buffer_a[BUFFER_LEN];
+static struct element buffer_b[BUFFER_LEN];
+static uint64_t bitmap_a[STATIC_MEM_CACHE_BITMAP_WORDS(BUFFER_LEN)];
+static uint64_t bitmap_b[STATIC_MEM_CACHE_BITMAP_WORDS(BUFFER_LEN)];
+static void *ptrs[GROWN_LEN];
+
+int main(void)
+{
+	int failed = 0;
+	TEST_RUN(_test_init_errors, failed);
+	TEST_RUN(_test_fixed, failed);
+	TEST_RUN(_test_growable, failed);
+	TEST_RUN(_test_stray_pointers, failed);
+	printf("test_static_mem_cache: %s\n", 0 == failed ? "ok" : "FAILED");
+	return 0 != failed;
+}
+
+static int _cache_init(struct static_mem_cache *cache, struct element *buffer,
+		       uint64_t *bitmap)
+{
+	return static_mem_cache_init(cache, buffer, BUFFER_LEN,
+				     sizeof(struct element), bitmap,
+				     STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE |
+					     STATIC_MEM_CACHE_FLAG_GROWABLE);
+}
+
+static int _test_init_errors(void)
+{
+	struct static_mem_cache cache;
+	TEST_CHECK(STATIC_MEM_CACHE_INIT_ERROR_NULL_CACHE ==
+		   static_mem_cache_init(NULL, buffer_a, BUFFER_LEN,
+					 sizeof(struct element), NULL, 0));
+	TEST_CHECK(STATIC_MEM_CACHE_INIT_ERROR_NO_BUFFER ==
+		   static_mem_cache_init(&cache, NULL, BUFFER_LEN,
+					 sizeof(struct element), NULL, 0));
+	TEST_CHECK(STATIC_MEM_CACHE_INIT_ERROR_ELEMENT_TOO_SMALL ==
+		   static_mem_cache_init(&cache, buffer_a, BUFFER_LEN,
+					 sizeof(void *) - 1, NULL, 0));
+	TEST_CHECK(STATIC_MEM_CACHE_INIT_ERROR_ELEMENT_TOO_LARGE ==
+		   static_mem_cache_init(&cache, buffer_a, 1,
+					 STATIC_MEM_CACHE_SLAB_BYTES, NULL,
+					 STATIC_MEM_CACHE_FLAG_GROWABLE));
+	TEST_CHECK(STATIC_MEM_CACHE_INIT_ERROR_NO_BITMAP ==
+		   static_mem_cache_init(&cache, buffer_a, BUFFER_LEN,
+					 sizeof(struct element), NULL,
+					 STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE));
+	return 0;
+}
+
+static int _test_fixed(void)
+{
+	struct static_mem_cache cache;
+	TEST_CHECK(STATIC_MEM_CACHE_INIT_ERROR_OK ==
+		   static_mem_cache_init(&cache, buffer_a, BUFFER_LEN,
+					 sizeof(struct element), bitmap_a,
+					 STATIC_MEM_CACHE_FLAG_CHECK_DOUBLE_FREE));
+	for (size_t i = 0; i < BUFFER_LEN; ++i) {
+		const struct static_mem_cache_malloc_result result =
+			static_mem_cache_malloc(&cache);
+		TEST_CHECK(STATIC_MEM_CACHE_MALLOC_ERROR_OK == result.error);
+		ptrs[i] = result.ptr;
+	}
+	TEST_CHECK(STATIC_MEM_CACHE_MALLOC_ERROR_OOM ==
+		   static_mem_cache_malloc(&cache).error);
+	TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_OK ==
+		   static_mem_cache_free(&cache, NULL));
+	TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_NOT_IN_BUFFER ==
+		   static_mem_cache_free(&cache, &buffer_b[0]));
+	TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_MISALIGNED ==
+		   static_mem_cache_free(&cache, (char *)ptrs[3] + 1));
+	TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_OK ==
+		   static_mem_cache_free(&cache, ptrs[3]));
+	TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_IN_FREE_LIST ==
+		   static_mem_cache_free(&cache, ptrs[3]));
+	// The freed element is handed out again.
+	TEST_CHECK(ptrs[3] == static_mem_cache_malloc(&cache).ptr);
+	for (size_t i = 0; i < BUFFER_LEN; ++i) {
+		TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_OK ==
+			   static_mem_cache_free(&cache, ptrs[i]));
+	}
+	TEST_CHECK(0 == cache.used_count);
+	TEST_CHECK(STATIC_MEM_CACHE_MALLOC_ERROR_NULL_CACHE ==
+		   static_mem_cache_malloc(NULL).error);
+	TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_NULL_CACHE ==
+		   static_mem_cache_free(NULL, ptrs[0]));
+	return 0;
+}
+
+static int _test_growable(void)
+{
+	struct static_mem_cache cache;
+	TEST_CHECK(STATIC_MEM_CACHE_INIT_ERROR_OK ==
+		   _cache_init(&cache, buffer_a, bitmap_a));
+	for (size_t i = 0; i < GROWN_LEN; ++i) {
+		const struct static_mem_cache_malloc_result result =
+			static_mem_cache_malloc(&cache);
+		TEST_CHECK(STATIC_MEM_CACHE_MALLOC_ERROR_OK == result.error);
+		ptrs[i] = result.ptr;
+	}
+	TEST_CHECK(GROWN_LEN == cache.used_count);
+	TEST_CHECK(cache.slabs_len > 1);
+	// The registry has to stay sorted for the lookup in free.
+	for (size_t i = 1; i < cache.slabs_len; ++i) {
+		TEST_CHECK((uintptr_t)cache.slabs[i - 1] <
+			   (uintptr_t)cache.slabs[i]);
+	}
+	const size_t in_slab = GROWN_LEN - 1;
+	TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_MISALIGNED ==
+		   static_mem_cache_free(&cache, (char *)ptrs[in_slab] + 8));
+	TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_OK ==
+		   static_mem_cache_free(&cache, ptrs[in_slab]));
+	TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_IN_FREE_LIST ==
+		   static_mem_cache_free(&cache, ptrs[in_slab]));
+	for (size_t i = 0; i < in_slab; ++i) {
+		TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_OK ==
+			   static_mem_cache_free(&cache, ptrs[i]));
+	}
+	TEST_CHECK(0 == cache.used_count);
+	// Everything is back under the low water mark so every slab is unmapped.
+	TEST_CHECK(0 == cache.slabs_len);
+	return 0;
+}
+
+static int _test_stray_pointers(void)
+{
+	struct static_mem_cache cache_a;
+	struct static_mem_cache cache_b;
+	TEST_CHECK(STATIC_MEM_CACHE_INIT_ERROR_OK ==
+		   _cache_init(&cache_a, buffer_a, bitmap_a));
+	TEST_CHECK(STATIC_MEM_CACHE_INIT_ERROR_OK ==
+		   _cache_init(&cache_b, buffer_b, bitmap_b));
+	for (size_t i = 0; i < BUFFER_LEN + 1; ++i) {
+		ptrs[i] = static_mem_cache_malloc(&cache_a).ptr;
+		TEST_CHECK(NULL != ptrs[i]);
+		ptrs[BUFFER_LEN + 1 + i] = static_mem_cache_malloc(&cache_b).ptr;
+		TEST_CHECK(NULL != ptrs[BUFFER_LEN + 1 + i]);
+	}
+	// An element of another cache's slab is rejected, not freed into this one.
+	TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_NOT_IN_BUFFER ==
+		   static_mem_cache_free(&cache_a, ptrs[2 * BUFFER_LEN + 1]));
+	TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_NOT_IN_BUFFER ==
+		   static_mem_cache_free(&cache_b, ptrs[BUFFER_LEN]));
+	// A pointer whose slab aligned address isn't readable. Reading a header
+	// there would crash.
+	char *hole = mmap(NULL, 2 * STATIC_MEM_CACHE_SLAB_BYTES, PROT_NONE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	TEST_CHECK(MAP_FAILED != hole);
+	char *aligned = (char *)(((uintptr_t)hole + STATIC_MEM_CACHE_SLAB_BYTES -
+				  1) &
+				 ~(STATIC_MEM_CACHE_SLAB_BYTES - 1));
+	TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_NOT_IN_BUFFER ==
+		   static_mem_cache_free(&cache_a, aligned + 4096));
+	TEST_CHECK(0 == munmap(hole, 2 * STATIC_MEM_CACHE_SLAB_BYTES));
+	for (size_t i = 0; i < 2 * (BUFFER_LEN + 1); ++i) {
+		TEST_CHECK(STATIC_MEM_CACHE_FREE_ERROR_OK ==
+			   static_mem_cache_free(i < BUFFER_LEN + 1 ? &cache_a :
+								      &cache_b,
+						 ptrs[i]));
+	}
+	TEST_CHECK(0 == cache_a.slabs_len && 0 == cache_b.slabs_len);
+	return 0;
+}
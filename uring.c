@@ -0,0 +1,175 @@
+// Needed for syscall and MAP_POPULATE with -std=c11.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+// The kernel reads and writes the ring indices concurrently with us.
+static uint32_t _index_load(const uint32_t *index);
+static void _index_store(uint32_t *index, uint32_t value);
+// Hands every queued SQE to the kernel. @returns 0 or errno.
+static int _enter(struct uring *ring, uint32_t min_complete, uint32_t flags,
+		  const void *arg, size_t arg_bytes);
+
+enum uring_init_error uring_init(struct uring *ring, uint32_t entries)
+{
+	if (NULL == ring) {
+		return URING_INIT_ERROR_NULL_RING;
+	}
+	*ring = (struct uring){ .fd = -1 };
+	struct io_uring_params params = { 0 };
+	const long fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0) {
+		return URING_INIT_ERROR_SETUP_FAIL;
+	}
+	ring->fd = (int)fd;
+	const uint32_t needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG;
+	if (needed != (params.features & needed)) {
+		uring_cleanup(ring);
+		return URING_INIT_ERROR_UNSUPPORTED;
+	}
+	// With IORING_FEAT_SINGLE_MMAP one mapping holds both rings.
+	const size_t sq_bytes =
+		params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	const size_t cq_bytes = params.cq_off.cqes +
+				params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->rings_bytes = sq_bytes > cq_bytes ? sq_bytes : cq_bytes;
+	ring->rings = mmap(NULL, ring->rings_bytes, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ring->fd,
+			   IORING_OFF_SQ_RING);
+	if (MAP_FAILED == ring->rings) {
+		ring->rings = NULL;
+		uring_cleanup(ring);
+		return URING_INIT_ERROR_MMAP_FAIL;
+	}
+	ring->sqes_bytes = params.sq_entries * sizeof(struct io_uring_sqe);
+	void *sqes = mmap(NULL, ring->sqes_bytes, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (MAP_FAILED == sqes) {
+		uring_cleanup(ring);
+		return URING_INIT_ERROR_MMAP_FAIL;
+	}
+	ring->sqes = (struct io_uring_sqe *)sqes;
+	char *rings = (char *)ring->rings;
+	ring->sq_head = (uint32_t *)(rings + params.sq_off.head);
+	ring->sq_tail = (uint32_t *)(rings + params.sq_off.tail);
+	ring->sq_mask = *(uint32_t *)(rings + params.sq_off.ring_mask);
+	ring->sq_array = (uint32_t *)(rings + params.sq_off.array);
+	ring->cq_head = (uint32_t *)(rings + params.cq_off.head);
+	ring->cq_tail = (uint32_t *)(rings + params.cq_off.tail);
+	ring->cq_mask = *(uint32_t *)(rings + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+	// SQE i always goes in slot i of the array so it's filled in once.
+	for (uint32_t i = 0; i <= ring->sq_mask; ++i) {
+		ring->sq_array[i] = i;
+	}
+	return URING_INIT_ERROR_OK;
+}
+
+void uring_cleanup(struct uring *ring)
+{
+	if (NULL == ring) {
+		return;
+	}
+	if (NULL != ring->sqes) {
+		(void)munmap(ring->sqes, ring->sqes_bytes);
+		ring->sqes = NULL;
+	}
+	if (NULL != ring->rings) {
+		(void)munmap(ring->rings, ring->rings_bytes);
+		ring->rings = NULL;
+	}
+	if (ring->fd >= 0) {
+		(void)close(ring->fd);
+		ring->fd = -1;
+	}
+}
+
+struct io_uring_sqe *uring_sqe_get(struct uring *ring)
+{
+	const uint32_t tail = *ring->sq_tail;
+	if (tail - _index_load(ring->sq_head) > ring->sq_mask) {
+		if (0 != _enter(ring, 0, 0, NULL, 0)) {
+			return NULL;
+		}
+		// The kernel consumes submitted SQEs before io_uring_enter returns.
+		if (tail - _index_load(ring->sq_head) > ring->sq_mask) {
+			return NULL;
+		}
+	}
+	struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	_index_store(ring->sq_tail, tail + 1);
+	++ring->sq_queued;
+	return sqe;
+}
+
+int uring_submit_and_wait(struct uring *ring, uint64_t timeout_ns)
+{
+	if (0 == timeout_ns) {
+		return _enter(ring, 0, 0, NULL, 0);
+	}
+	struct __kernel_timespec ts = {
+		.tv_sec = (long long)(timeout_ns / 1000000000),
+		.tv_nsec = (long long)(timeout_ns % 1000000000),
+	};
+	struct io_uring_getevents_arg arg = {
+		.ts = UINT64_MAX == timeout_ns ? 0 : (uint64_t)(uintptr_t)&ts,
+	};
+	return _enter(ring, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+		      &arg, sizeof(arg));
+}
+
+struct io_uring_cqe *uring_cqe_peek(struct uring *ring)
+{
+	const uint32_t head = *ring->cq_head;
+	if (head == _index_load(ring->cq_tail)) {
+		return NULL;
+	}
+	return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *ring)
+{
+	_index_store(ring->cq_head, *ring->cq_head + 1);
+}
+
+static uint32_t _index_load(const uint32_t *index)
+{
+	return atomic_load_explicit((const _Atomic uint32_t *)index,
+				    memory_order_acquire);
+}
+
+static void _index_store(uint32_t *index, uint32_t value)
+{
+	atomic_store_explicit((_Atomic uint32_t *)index, value,
+			      memory_order_release);
+}
+
+static int _enter(struct uring *ring, uint32_t min_complete, uint32_t flags,
+		  const void *arg, size_t arg_bytes)
+{
+	const long result = syscall(__NR_io_uring_enter, ring->fd,
+				    ring->sq_queued, min_complete, flags, arg,
+				    arg_bytes);
+	const int enter_errno = result < 0 ? errno : 0;
+	// Whatever the kernel didn't take (it can run short of memory) is still
+	// queued for next time.
+	ring->sq_queued = *ring->sq_tail - _index_load(ring->sq_head);
+	// ETIME is the wait timing out.
+	if (ETIME == enter_errno || EINTR == enter_errno) {
+		return 0;
+	}
+	return enter_errno;
+}
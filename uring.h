@@ -0,0 +1,73 @@
+#ifndef _TECZKA_URING_H
+#define _TECZKA_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/io_uring.h>
+
+enum uring_init_error {
+	URING_INIT_ERROR_OK = 0,
+	URING_INIT_ERROR_NULL_RING,
+	URING_INIT_ERROR_SETUP_FAIL,
+	URING_INIT_ERROR_UNSUPPORTED,
+	URING_INIT_ERROR_MMAP_FAIL,
+};
+
+/* uring is the little bit of io_uring the event loop needs, on raw syscalls so
+ * there's no liburing to depend on. SQEs are filled in with uring_sqe_get and only
+ * go to the kernel with uring_submit_and_wait, so everything queued during a loop
+ * iteration is submitted together with the wait for completions in one
+ * io_uring_enter. Completions are read straight out of the shared ring.
+ *
+ * It needs a kernel that maps both rings at once (IORING_FEAT_SINGLE_MMAP) and
+ * takes a timeout on io_uring_enter (IORING_FEAT_EXT_ARG), so 5.11 or newer.
+ */
+struct uring {
+	int fd;
+	// Submission queue. The kernel owns head and we own tail.
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t sq_mask;
+	uint32_t *sq_array;
+	struct io_uring_sqe *sqes;
+	// SQEs filled in since the last io_uring_enter.
+	uint32_t sq_queued;
+	// Completion queue. We own head and the kernel owns tail.
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t cq_mask;
+	struct io_uring_cqe *cqes;
+	void *rings;
+	size_t rings_bytes;
+	size_t sqes_bytes;
+};
+
+/* Sets up a ring with room for entries SQEs. The completion queue gets twice that.
+ * @returns URING_INIT_ERROR_OK or what went wrong.
+ * @error URING_INIT_ERROR_SETUP_FAIL: io_uring_setup failed. errno says why.
+ * @error URING_INIT_ERROR_UNSUPPORTED: The kernel is too old.
+ * @error URING_INIT_ERROR_MMAP_FAIL: The rings couldn't be mapped.
+ */
+enum uring_init_error uring_init(struct uring *ring, uint32_t entries);
+void uring_cleanup(struct uring *ring);
+
+/* Returns a zeroed SQE to fill in. It's submitted with the next
+ * uring_submit_and_wait. If the submission queue is full, what's queued is
+ * submitted first. Returns NULL if that fails.
+ */
+struct io_uring_sqe *uring_sqe_get(struct uring *ring);
+
+/* Submits every queued SQE and waits until there's a completion or timeout_ns
+ * passes. A timeout_ns of UINT64_MAX waits forever and 0 doesn't wait at all.
+ * @returns 0 or the errno io_uring_enter failed with. A timeout or signal isn't a
+ * failure.
+ */
+int uring_submit_and_wait(struct uring *ring, uint64_t timeout_ns);
+
+// Returns the oldest completion or NULL if there are none. It stays in the ring
+// until uring_cqe_seen.
+struct io_uring_cqe *uring_cqe_peek(struct uring *ring);
+void uring_cqe_seen(struct uring *ring);
+
+#endif // _TECZKA_URING_H
@@ -10,6 +10,8 @@
 
 #define MS_PER_SEC (1000)
 #define NS_PER_MS (1000000)
+#define US_PER_SEC (1000000)
+#define NS_PER_US (1000)
 
 static inline uint64_t timespec_to_ms(const struct timespec *ts)
 {
@@ -33,6 +35,15 @@ uint64_t timestamp_ms_get(void)
 	return timespec_to_ms(&ts);
 }
 
+uint64_t timestamp_us_get(void)
+{
+	struct timespec ts;
+	// See timestamp_ms_get for why CLOCK_BOOTTIME.
+	(void)clock_gettime(CLOCK_BOOTTIME, &ts);
+	return (uint64_t)ts.tv_sec * US_PER_SEC +
+	       (uint64_t)ts.tv_nsec / NS_PER_US;
+}
+
 void sleep_ms(uint64_t ms)
 {
 	struct timespec ts;
@@ -45,6 +56,8 @@ void sleep_ms(uint64_t ms)
 	} while (0 != sleep_result && EINTR == errno);
 }
 
+#undef NS_PER_US
+#undef US_PER_SEC
 #undef NS_PER_MS
 #undef MS_PER_SEC
 #undef _POSIX_C_SOURCE
@@ -17,6 +17,9 @@ struct data_buffer {
  */
 uint64_t timestamp_ms_get(void);
 
+// Same as timestamp_ms_get but in microseconds. Use this to time short operations.
+uint64_t timestamp_us_get(void);
+
 void sleep_ms(uint64_t ms);
 
 #endif // _TECZKA_UTIL_H